@@ -0,0 +1,754 @@
+/**
+ * Copyright (c) 2014, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Benchmark of the line editor. Keystroke traces (synthetic or recorded ones
+ * loaded from files) are passed to lineedit_keypress and the number of bytes
+ * and print handler calls needed to update the terminal is measured. Every
+ * trace is run once more with a mock terminal attached to check if the
+ * screen contents match the edited line after every keypress. With -w, the
+ * terminal is narrow and long lines are scrolled horizontally.
+ *
+ * Usage: bench [-t milliseconds] [-u] [-w columns] [trace files]
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <locale.h>
+#include <wchar.h>
+
+#include "lineedit.h"
+#include "terminal.h"
+
+#define BENCH_LINE_LEN 4096
+#define BENCH_TERMINAL_ROWS 4
+#define BENCH_TERMINAL_COLS (BENCH_LINE_LEN + 64)
+#define BENCH_OUTPUT_BUFFER_SIZE 256
+#define BENCH_FEED_CHUNK 64
+#define BENCH_MIN_VIEW 10
+#define BENCH_HINT_BUCKETS 1024
+#define BENCH_UNDO_SIZE 1024
+
+static const char *prompt = "bench > ";
+static const char *cont_prompt = "  ... ";
+
+struct trace {
+	const char *name;
+	char *buf;
+	uint32_t len;
+	uint32_t size;
+
+	/**
+	 * Pass the trace using lineedit_feed in chunks instead of calling
+	 * lineedit_keypress for every character.
+	 */
+	uint32_t feed;
+
+	/**
+	 * Expected line contents at the end of the trace (NULL if not checked).
+	 */
+	char *expect;
+
+	/**
+	 * Editor options set by the trace file.
+	 */
+	uint32_t multiline;
+	uint32_t hints;
+	uint32_t undo;
+};
+
+struct counter {
+	uint32_t bytes;
+	uint32_t calls;
+};
+
+/* Benchmark options. */
+static uint32_t duration_ms = 300;
+static uint32_t unbuffered = 0;
+static uint32_t width = 0;
+
+
+static int32_t prompt_callback(struct lineedit *le, void *ctx) {
+	(void)ctx;
+
+	lineedit_escape_print(le, ESC_COLOR, LINEEDIT_FG_COLOR_GREEN);
+	lineedit_print(le, prompt);
+	lineedit_escape_print(le, ESC_DEFAULT, 0);
+
+	return strlen(prompt);
+}
+
+
+/* Print handler used for timed runs, it only counts the output. */
+static int32_t counter_print(const char *line, void *ctx) {
+	struct counter *c = (struct counter *)ctx;
+
+	c->calls++;
+	c->bytes += strlen(line);
+
+	return 0;
+}
+
+
+static void trace_append(struct trace *t, const char *s, uint32_t len) {
+	if ((t->len + len) > t->size) {
+		while ((t->len + len) > t->size) {
+			t->size = (t->size > 0) ? (t->size * 2) : 4096;
+		}
+		t->buf = realloc(t->buf, t->size);
+		if (t->buf == NULL) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	memcpy(t->buf + t->len, s, len);
+	t->len += len;
+}
+
+
+static void trace_append_str(struct trace *t, const char *s) {
+	trace_append(t, s, strlen(s));
+}
+
+
+static void trace_repeat(struct trace *t, const char *s, uint32_t count) {
+	for (uint32_t i = 0; i < count; i++) {
+		trace_append_str(t, s);
+	}
+}
+
+
+/* Ordinary typing of command lines, each one finished with enter. */
+static void scenario_typing(struct trace *t) {
+	char line[80];
+
+	for (uint32_t i = 0; i < 200; i++) {
+		snprintf(line, sizeof(line), "set interface eth%u address 10.0.%u.%u/24\r", i % 4, i / 4, i);
+		trace_append_str(t, line);
+	}
+}
+
+
+/* A line is typed, cursor is moved to its middle and more text is inserted. */
+static void scenario_midline(struct trace *t) {
+	for (uint32_t i = 0; i < 100; i++) {
+		trace_append_str(t, "route add 192.168.0.0/16 via 10.0.0.1 metric 100 table main");
+		trace_repeat(t, "\x1b[D", 30);
+		trace_append_str(t, "dev eth0 proto static scope link ");
+		trace_append_str(t, "\r");
+	}
+}
+
+
+/* Long lines are typed and deleted using backspace. */
+static void scenario_backspace(struct trace *t) {
+	for (uint32_t i = 0; i < 100; i++) {
+		trace_append_str(t, "the quick brown fox jumps over the lazy dog, again and again and again");
+		trace_repeat(t, "\x7f", 40);
+		trace_append_str(t, "\r");
+	}
+}
+
+
+/* History is filled and then browsed back and forth. */
+static void scenario_history(struct trace *t) {
+	char line[80];
+
+	for (uint32_t i = 0; i < 30; i++) {
+		snprintf(line, sizeof(line), "show log %u last %u lines\r", i, i * 10);
+		trace_append_str(t, line);
+	}
+	for (uint32_t i = 0; i < 20; i++) {
+		trace_repeat(t, "\x1b[A", 30);
+		trace_repeat(t, "\x1b[B", 30);
+	}
+	trace_repeat(t, "\x1b[A", 5);
+}
+
+
+/* Long bracketed pastes. */
+static void scenario_paste(struct trace *t) {
+	for (uint32_t i = 0; i < 10; i++) {
+		trace_append_str(t, "echo ");
+		trace_append_str(t, "\x1b[200~");
+		for (uint32_t j = 0; j < 3000; j++) {
+			char c = 'a' + (i + j) % 26;
+			trace_append(t, (j % 80 == 79) ? "\n" : &c, 1);
+		}
+		trace_append_str(t, "\x1b[201~");
+		trace_append_str(t, "\r");
+	}
+}
+
+
+static int hex_value(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+
+/**
+ * Load a recorded trace. Lines starting with '#' are comments, line starting
+ * with "expect " contains the expected final line. Lines starting with
+ * "option " enable an editor option, "multiline" (rows must fit the terminal
+ * then), "hints" and "undo" are supported. All other lines contain keystrokes
+ * with C-like escapes (\r, \n, \t, \e, \\ and \xNN). Line endings in the file
+ * are not part of the trace.
+ */
+static int32_t trace_load(struct trace *t, const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		return -1;
+	}
+
+	char line[1024];
+	while (fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\r\n")] = '\0';
+
+		if (line[0] == '#') {
+			continue;
+		}
+		if (!strncmp(line, "expect ", 7)) {
+			free(t->expect);
+			t->expect = strdup(line + 7);
+			continue;
+		}
+		if (!strncmp(line, "option ", 7)) {
+			if (!strcmp(line + 7, "multiline")) {
+				t->multiline = 1;
+			} else if (!strcmp(line + 7, "hints")) {
+				t->hints = 1;
+			} else if (!strcmp(line + 7, "undo")) {
+				t->undo = 1;
+			} else {
+				fprintf(stderr, "unknown option '%s'\n", line + 7);
+				fclose(f);
+				return -1;
+			}
+			continue;
+		}
+
+		for (char *s = line; *s; s++) {
+			char c = *s;
+			if (c == '\\' && s[1] != '\0') {
+				s++;
+				switch (*s) {
+					case 'r': c = '\r'; break;
+					case 'n': c = '\n'; break;
+					case 't': c = '\t'; break;
+					case 'e': c = 0x1b; break;
+					case 'x':
+						if (hex_value(s[1]) >= 0 && hex_value(s[2]) >= 0) {
+							c = hex_value(s[1]) * 16 + hex_value(s[2]);
+							s += 2;
+						}
+						break;
+					default: c = *s; break;
+				}
+			}
+			trace_append(t, &c, 1);
+		}
+	}
+	fclose(f);
+
+	return 0;
+}
+
+
+/* Display width of the UTF-8 string @a s. */
+static uint32_t string_width(const char *s) {
+	static wchar_t wide[BENCH_LINE_LEN + 1];
+
+	size_t n = mbstowcs(wide, s, BENCH_LINE_LEN + 1);
+	return (n != (size_t)-1) ? wcswidth(wide, n) : strlen(s);
+}
+
+
+/* Autosuggestion expected after the line @a text: the rest of the newest
+ * history entry extending it, as much as fits the terminal. There is none
+ * if it starts with a zero width character, it would combine with the
+ * line. Returns the length of the suggestion. */
+static uint32_t hint_expected(struct lineedit *le, const char *text, const char **hint) {
+	uint32_t n = strlen(text);
+	if (le->hint_index == NULL || n == 0) {
+		return 0;
+	}
+
+	const char *entry = NULL;
+	for (uint32_t i = 0; i < le->history_count; i++) {
+		char *e;
+		if (lineedit_history_recall(le, &e, i) == LINEEDIT_HISTORY_RECALL_OK &&
+		    strlen(e) > n && !memcmp(e, text, n)) {
+			entry = e;
+			break;
+		}
+	}
+	if (entry == NULL) {
+		return 0;
+	}
+
+	uint32_t cols = (width > 0) ? width : LINEEDIT_TERMINAL_WIDTH;
+	uint32_t used = strlen(prompt) + string_width(text) + 1;
+	uint32_t avail = (cols > used) ? (cols - used) : 0;
+	*hint = entry + n;
+	uint32_t len = 0;
+	mbstate_t ps;
+	memset(&ps, 0, sizeof(ps));
+	while ((*hint)[len] != '\0') {
+		wchar_t wc;
+		size_t l = mbrtowc(&wc, *hint + len, strlen(*hint + len), &ps);
+		int w = (l < (size_t)-2) ? wcwidth(wc) : -1;
+		if (w < 0 || (len == 0 && w == 0) || (uint32_t)w > avail) {
+			break;
+		}
+		avail -= w;
+		len += l;
+	}
+
+	return len;
+}
+
+
+/* Check if the terminal row shows the search label with the query followed
+ * by the matching history entry, the cursor must be at the match. Before
+ * anything is searched, the edited line is shown. The label and the entry
+ * are scrolled together if they don't fit the terminal. */
+static int32_t screen_check_search(struct lineedit *le, struct terminal *term) {
+	static char row[BENCH_TERMINAL_COLS * TERMINAL_CELL_SIZE + 1];
+	static char expected[BENCH_TERMINAL_COLS * TERMINAL_CELL_SIZE + 1];
+	static char shown[BENCH_TERMINAL_COLS * TERMINAL_CELL_SIZE + 1];
+	static char query[LINEEDIT_SEARCH_LEN + 1];
+	char *text;
+
+	lineedit_get_line(le, &text);
+	uint32_t cursor = 0;
+	lineedit_get_cursor(le, &cursor);
+	snprintf(query, sizeof(query), "%.*s", (int)le->search_len, le->search_query);
+	uint32_t failed = le->search_failed_len > 0 && le->search_len >= le->search_failed_len;
+
+	const char *line = text;
+	uint32_t pos = cursor;
+	if (le->search_len > 0) {
+		if (le->search_line == NULL) {
+			fprintf(stderr, "search mismatch: no match shown for '%s'\n", query);
+			return -1;
+		}
+		line = le->search_line;
+		const char *match = strstr(line, query);
+		if (match == NULL && !failed) {
+			fprintf(stderr, "search mismatch: '%s' does not contain '%s'\n", line, query);
+			return -1;
+		}
+		pos = (match != NULL) ? (uint32_t)(match - line) : 0;
+	}
+
+	int label_len = snprintf(shown, sizeof(shown), "(%sreverse-i-search)`%s': ", failed ? "failed " : "", query);
+	snprintf(shown + label_len, sizeof(shown) - label_len, "%s", line);
+	uint32_t shown_len = strlen(shown);
+	uint32_t view = le->view;
+	uint32_t view_end = le->view_end;
+	if (view > view_end || view_end > shown_len) {
+		fprintf(stderr, "view mismatch: view %u-%u, search length %u\n", view, view_end, shown_len);
+		return -1;
+	}
+	snprintf(expected, sizeof(expected), "%s%.*s%s", (view > 0) ? "<" : "",
+		(int)(view_end - view), shown + view, (view_end < shown_len) ? ">" : "");
+	uint32_t len = strlen(expected);
+	while (len > 0 && expected[len - 1] == ' ') {
+		expected[--len] = '\0';
+	}
+	terminal_get_row(term, term->row, row);
+	if (strcmp(row, expected)) {
+		fprintf(stderr, "screen mismatch:\n  screen: '%s'\n  search: '%s'\n", row, expected);
+		return -1;
+	}
+
+	/* A failed search leaves the cursor where the last match was. */
+	pos += label_len;
+	if (!failed) {
+		if (pos < view || pos > view_end) {
+			fprintf(stderr, "view mismatch: view %u-%u, match at %u\n", view, view_end, pos);
+			return -1;
+		}
+		snprintf(expected, sizeof(expected), "%s%.*s", (view > 0) ? "<" : "", (int)(pos - view), shown + view);
+		uint32_t col = string_width(expected);
+		if (term->col != col) {
+			fprintf(stderr, "cursor mismatch: screen %u, search %u\n", term->col, col);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Check if the terminal rows show the line edited in the multi-line mode.
+ * Rows following the first one start with the continuation prompt, the row
+ * below the last one must be empty. */
+static int32_t screen_check_rows(struct lineedit *le, struct terminal *term) {
+	static char row[BENCH_TERMINAL_COLS * TERMINAL_CELL_SIZE + 1];
+	static char expected[BENCH_TERMINAL_COLS * TERMINAL_CELL_SIZE + 1];
+	char *text;
+
+	lineedit_get_line(le, &text);
+	uint32_t cursor = 0;
+	lineedit_get_cursor(le, &cursor);
+
+	/* The first row is above the terminal cursor by the number of
+	 * newlines before the line cursor. */
+	uint32_t cursor_row = 0;
+	const char *cursor_start = text;
+	for (uint32_t i = 0; i < cursor; i++) {
+		if (text[i] == '\n') {
+			cursor_row++;
+			cursor_start = text + i + 1;
+		}
+	}
+	if (cursor_row > term->row) {
+		fprintf(stderr, "cursor mismatch: screen row %u, line row %u\n", term->row, cursor_row);
+		return -1;
+	}
+	uint32_t first = term->row - cursor_row;
+
+	uint32_t r = first;
+	const char *s = text;
+	while (1) {
+		uint32_t n = strcspn(s, "\n");
+		snprintf(expected, sizeof(expected), "%s%.*s", (r == first) ? prompt : cont_prompt, (int)n, s);
+		uint32_t len = strlen(expected);
+		while (len > 0 && expected[len - 1] == ' ') {
+			expected[--len] = '\0';
+		}
+		if (r >= term->rows) {
+			fprintf(stderr, "screen mismatch: line has more rows than the terminal\n");
+			return -1;
+		}
+		terminal_get_row(term, r, row);
+		if (strcmp(row, expected)) {
+			fprintf(stderr, "screen mismatch in row %u:\n  screen: '%s'\n  line:   '%s'\n", r - first, row, expected);
+			return -1;
+		}
+		if (s[n] == '\0') {
+			break;
+		}
+		s += n + 1;
+		r++;
+	}
+	if ((r + 1) < term->rows) {
+		terminal_get_row(term, r + 1, row);
+		if (row[0] != '\0') {
+			fprintf(stderr, "screen mismatch below the line:\n  screen: '%s'\n", row);
+			return -1;
+		}
+	}
+
+	snprintf(expected, sizeof(expected), "%s%.*s", (cursor_row == 0) ? prompt : cont_prompt,
+		(int)(text + cursor - cursor_start), cursor_start);
+	uint32_t col = string_width(expected);
+	if (term->col != col) {
+		fprintf(stderr, "cursor mismatch: screen %u, line %u\n", term->col, col);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Check if the terminal row with the prompt shows the edited line and its
+ * autosuggestion (erased when the line is @a entered). If the line is
+ * scrolled, the visible part must fit the terminal and contain the
+ * cursor. */
+static int32_t screen_check(struct lineedit *le, struct terminal *term, uint32_t entered) {
+	static char row[BENCH_TERMINAL_COLS * TERMINAL_CELL_SIZE + 1];
+	static char expected[BENCH_TERMINAL_COLS * TERMINAL_CELL_SIZE + 1];
+	char *text;
+
+	if (le->search) {
+		return screen_check_search(le, term);
+	}
+	if (le->multiline) {
+		return screen_check_rows(le, term);
+	}
+
+	lineedit_get_line(le, &text);
+	uint32_t cursor = 0;
+	lineedit_get_cursor(le, &cursor);
+	uint32_t view = le->view;
+	uint32_t view_end = le->view_end;
+	uint32_t text_len = strlen(text);
+	if (view > cursor || cursor > view_end || view_end > text_len) {
+		fprintf(stderr, "view mismatch: view %u-%u, cursor %u, line length %u\n", view, view_end, cursor, text_len);
+		return -1;
+	}
+	const char *hint = "";
+	uint32_t hint_len = 0;
+	if (!entered && view == 0 && view_end == text_len) {
+		hint_len = hint_expected(le, text, &hint);
+	}
+	snprintf(expected, sizeof(expected), "%s%s%.*s%s%.*s", prompt, (view > 0) ? "<" : "",
+		(int)(view_end - view), text + view, (view_end < text_len) ? ">" : "", (int)hint_len, hint);
+	if (width > 0 && string_width(expected) >= width) {
+		fprintf(stderr, "view too wide: '%s'\n", expected);
+		return -1;
+	}
+	uint32_t len = strlen(expected);
+	while (len > 0 && expected[len - 1] == ' ') {
+		expected[--len] = '\0';
+	}
+
+	terminal_get_row(term, term->row, row);
+	if (strcmp(row, expected)) {
+		fprintf(stderr, "screen mismatch:\n  screen: '%s'\n  line:   '%s'\n", row, expected);
+		return -1;
+	}
+
+	/* The cursor is a byte offset, the terminal column depends on widths
+	 * of the characters before it. */
+	snprintf(expected, sizeof(expected), "%s%s%.*s", prompt, (view > 0) ? "<" : "", (int)(cursor - view), text + view);
+	uint32_t col = string_width(expected);
+	if (term->col != col) {
+		fprintf(stderr, "cursor mismatch: screen %u, line %u\n", term->col, col);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Run the trace once. If @a term is not NULL, the output is interpreted
+ * by the mock terminal and the screen is checked after every keypress
+ * (except during a paste). Returns the number of processed keypresses or -1
+ * if the check failed.
+ */
+static int64_t trace_run(struct trace *t, int32_t (*print_handler)(const char *line, void *ctx), void *ctx, struct terminal *term) {
+	static char output_buffer[BENCH_OUTPUT_BUFFER_SIZE];
+	struct lineedit le;
+	int64_t ret = t->len;
+
+	if (lineedit_init(&le, BENCH_LINE_LEN) != LINEEDIT_INIT_OK) {
+		return -1;
+	}
+	lineedit_set_print_handler(&le, print_handler, ctx);
+	lineedit_set_prompt_callback(&le, prompt_callback, NULL);
+	lineedit_set_width(&le, width);
+	if (t->multiline) {
+		lineedit_set_multiline(&le, 1, cont_prompt);
+	}
+	if (t->hints) {
+		static uint32_t hint_index[LINEEDIT_HINT_INDEX_LEN(BENCH_HINT_BUCKETS)];
+		lineedit_set_hint_index(&le, hint_index, BENCH_HINT_BUCKETS);
+	}
+	if (t->undo) {
+		static uint8_t undo_buffer[BENCH_UNDO_SIZE];
+		lineedit_set_undo_buffer(&le, undo_buffer, sizeof(undo_buffer));
+	}
+	if (!unbuffered) {
+		lineedit_set_output_buffer(&le, output_buffer, sizeof(output_buffer));
+	}
+	lineedit_refresh(&le);
+
+	uint32_t pos = 0;
+	while (pos < t->len) {
+		int32_t r;
+		if (t->feed) {
+			uint32_t chunk = t->len - pos;
+			if (chunk > BENCH_FEED_CHUNK) {
+				chunk = BENCH_FEED_CHUNK;
+			}
+			uint32_t consumed = 0;
+			r = lineedit_feed(&le, t->buf + pos, chunk, &consumed);
+			pos += consumed;
+		} else {
+			r = lineedit_keypress(&le, (unsigned char)t->buf[pos]);
+			pos++;
+		}
+
+		if (r == LINEEDIT_ENTER) {
+			if (term != NULL && screen_check(&le, term, 1)) {
+				ret = -1;
+				break;
+			}
+			print_handler("\r\n", ctx);
+			lineedit_clear(&le);
+			lineedit_refresh(&le);
+		} else if (term != NULL && !le.paste && screen_check(&le, term, 0)) {
+			ret = -1;
+			break;
+		}
+	}
+
+	if (ret >= 0 && term != NULL) {
+		if (screen_check(&le, term, 0)) {
+			ret = -1;
+		}
+		char *text;
+		lineedit_get_line(&le, &text);
+		if (t->expect != NULL && strcmp(text, t->expect)) {
+			fprintf(stderr, "line mismatch:\n  line:   '%s'\n  expect: '%s'\n", text, t->expect);
+			ret = -1;
+		}
+	}
+
+	lineedit_free(&le);
+
+	return ret;
+}
+
+
+static double time_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int32_t trace_bench(struct trace *t) {
+	struct terminal term;
+	int32_t check;
+
+	if (terminal_init(&term, BENCH_TERMINAL_ROWS, (width > 0) ? width : BENCH_TERMINAL_COLS) != TERMINAL_INIT_OK) {
+		return -1;
+	}
+	check = (trace_run(t, terminal_print, &term, &term) < 0) ? -1 : 0;
+	terminal_free(&term);
+
+	/* Repeat the trace until the requested time elapses. */
+	struct counter counter = {0};
+	uint64_t keys = 0;
+	uint32_t runs = 0;
+	double start = time_now();
+	double elapsed = 0.0;
+	do {
+		keys += trace_run(t, counter_print, &counter, NULL);
+		runs++;
+		elapsed = time_now() - start;
+	} while (elapsed < (duration_ms / 1000.0));
+
+	printf("%-16s %10u %14.0f %10.2f %10.3f   %s\n",
+		t->name,
+		t->len,
+		keys / elapsed,
+		(double)counter.bytes / keys,
+		(double)counter.calls / keys,
+		check ? "FAILED" : "ok"
+	);
+
+	return check;
+}
+
+
+int main(int argc, char *argv[]) {
+	int opt;
+
+	/* The mock terminal needs to know widths of UTF-8 characters. */
+	setlocale(LC_CTYPE, "C.UTF-8");
+
+	while ((opt = getopt(argc, argv, "t:uw:")) != -1) {
+		switch (opt) {
+			case 't':
+				duration_ms = atoi(optarg);
+				break;
+			case 'u':
+				unbuffered = 1;
+				break;
+			case 'w':
+				width = atoi(optarg);
+				if (width > BENCH_TERMINAL_COLS) {
+					width = BENCH_TERMINAL_COLS;
+				}
+				break;
+			default:
+				fprintf(stderr, "usage: %s [-t milliseconds] [-u] [-w columns] [trace files]\n", argv[0]);
+				return 1;
+		}
+	}
+
+	struct {
+		const char *name;
+		void (*generate)(struct trace *t);
+		uint32_t feed;
+	} scenarios[] = {
+		{"typing", scenario_typing, 0},
+		{"midline", scenario_midline, 0},
+		{"backspace", scenario_backspace, 0},
+		{"history", scenario_history, 0},
+		{"paste", scenario_paste, 0},
+		{"paste-feed", scenario_paste, 1},
+	};
+
+	/* The line editor does not fit narrower terminals. */
+	if (width > 0 && width < (strlen(prompt) + BENCH_MIN_VIEW)) {
+		fprintf(stderr, "terminal width must be at least %u columns\n", (uint32_t)strlen(prompt) + BENCH_MIN_VIEW);
+		return 1;
+	}
+
+	printf("%-16s %10s %14s %10s %10s   %s\n", "trace", "keys", "keys/s", "bytes/key", "calls/key", "screen");
+
+	int32_t failed = 0;
+	for (uint32_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		struct trace t = {0};
+		t.name = scenarios[i].name;
+		t.feed = scenarios[i].feed;
+		scenarios[i].generate(&t);
+		if (trace_bench(&t)) {
+			failed = 1;
+		}
+		free(t.buf);
+	}
+
+	for (int i = optind; i < argc; i++) {
+		struct trace t = {0};
+		const char *name = strrchr(argv[i], '/');
+		t.name = (name != NULL) ? (name + 1) : argv[i];
+		if (trace_load(&t, argv[i])) {
+			fprintf(stderr, "cannot load trace '%s'\n", argv[i]);
+			failed = 1;
+			continue;
+		}
+		if (trace_bench(&t)) {
+			failed = 1;
+		}
+		free(t.buf);
+		free(t.expect);
+	}
+
+	return failed;
+}
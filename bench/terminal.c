@@ -0,0 +1,292 @@
+/**
+ * Copyright (c) 2014, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* wcwidth and wcswidth are X/Open extensions. */
+#define _XOPEN_SOURCE 700
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "terminal.h"
+
+#define TERMINAL_ESC_NONE 0
+#define TERMINAL_ESC_ESC 1
+#define TERMINAL_ESC_CSI 2
+
+
+static char *terminal_cell(struct terminal *t, uint32_t row, uint32_t col) {
+	return t->screen + (row * t->cols + col) * TERMINAL_CELL_SIZE;
+}
+
+
+/* Clear row @a row starting at column @a col. A double width character
+ * is cleared whole. */
+static void terminal_clear(struct terminal *t, uint32_t row, uint32_t col) {
+	if (col > 0 && col < t->cols && terminal_cell(t, row, col)[0] == '\0') {
+		col--;
+	}
+	for (; col < t->cols; col++) {
+		strcpy(terminal_cell(t, row, col), " ");
+	}
+}
+
+
+int32_t terminal_init(struct terminal *t, uint32_t rows, uint32_t cols) {
+	if (t == NULL || rows == 0 || cols == 0) {
+		return TERMINAL_INIT_FAILED;
+	}
+
+	memset(t, 0, sizeof(struct terminal));
+	t->rows = rows;
+	t->cols = cols;
+	t->screen = malloc(rows * cols * TERMINAL_CELL_SIZE);
+	if (t->screen == NULL) {
+		return TERMINAL_INIT_FAILED;
+	}
+	for (uint32_t i = 0; i < rows; i++) {
+		terminal_clear(t, i, 0);
+	}
+
+	return TERMINAL_INIT_OK;
+}
+
+
+int32_t terminal_free(struct terminal *t) {
+	if (t == NULL) {
+		return TERMINAL_FREE_FAILED;
+	}
+
+	free(t->screen);
+
+	return TERMINAL_FREE_OK;
+}
+
+
+static void terminal_newline(struct terminal *t) {
+	if (t->row < (t->rows - 1)) {
+		t->row++;
+		return;
+	}
+
+	/* scroll the screen up */
+	memmove(t->screen, terminal_cell(t, 1, 0), (t->rows - 1) * t->cols * TERMINAL_CELL_SIZE);
+	terminal_clear(t, t->rows - 1, 0);
+}
+
+
+static void terminal_csi(struct terminal *t, char c) {
+	uint32_t n = (t->param > 0) ? t->param : 1;
+
+	/* Private sequences (bracketed paste mode) are ignored. */
+	if (t->private) {
+		return;
+	}
+
+	switch (c) {
+		case 'A':
+			t->row = (t->row > n) ? (t->row - n) : 0;
+			break;
+		case 'B':
+			t->row = ((t->row + n) < t->rows) ? (t->row + n) : (t->rows - 1);
+			break;
+		case 'C':
+			t->col = ((t->col + n) < t->cols) ? (t->col + n) : (t->cols - 1);
+			break;
+		case 'D':
+			t->col = (t->col > n) ? (t->col - n) : 0;
+			break;
+		case 'G':
+			t->col = (n <= t->cols) ? (n - 1) : (t->cols - 1);
+			break;
+		case 'K':
+			terminal_clear(t, t->row, t->col);
+			break;
+		case 'J':
+			terminal_clear(t, t->row, t->col);
+			for (uint32_t i = t->row + 1; i < t->rows; i++) {
+				terminal_clear(t, i, 0);
+			}
+			break;
+		case 's':
+			t->saved_row = t->row;
+			t->saved_col = t->col;
+			break;
+		case 'u':
+			t->row = t->saved_row;
+			t->col = t->saved_col;
+			break;
+		default:
+			/* Colors and other attributes are ignored. */
+			break;
+	}
+}
+
+
+/* Put character @a s (@a n bytes) at the cursor position. */
+static void terminal_put(struct terminal *t, const char *s, uint32_t n) {
+	wchar_t wc;
+	mbstate_t mbs = {0};
+	int w = 1;
+	if (mbrtowc(&wc, s, n, &mbs) == n) {
+		w = wcwidth(wc);
+	}
+
+	/* Combining marks are added to the previous character. */
+	if (w == 0) {
+		uint32_t col = (t->col > 0) ? (t->col - 1) : 0;
+		if (col > 0 && terminal_cell(t, t->row, col)[0] == '\0') {
+			col--;
+		}
+		char *cell = terminal_cell(t, t->row, col);
+		uint32_t len = strlen(cell);
+		if ((len + n) < TERMINAL_CELL_SIZE) {
+			memcpy(cell + len, s, n);
+			cell[len + n] = '\0';
+		}
+		return;
+	}
+	if (w < 0 || (t->col + w) > t->cols) {
+		w = 1;
+	}
+
+	/* Overwriting a half of a double width character erases it. */
+	if (t->col > 0 && terminal_cell(t, t->row, t->col)[0] == '\0') {
+		strcpy(terminal_cell(t, t->row, t->col - 1), " ");
+	}
+	uint32_t end = t->col + w;
+	if (end < t->cols && terminal_cell(t, t->row, end)[0] == '\0') {
+		strcpy(terminal_cell(t, t->row, end), " ");
+	}
+
+	char *cell = terminal_cell(t, t->row, t->col);
+	memcpy(cell, s, n);
+	cell[n] = '\0';
+	if (w == 2) {
+		terminal_cell(t, t->row, t->col + 1)[0] = '\0';
+	}
+
+	/* The cursor stays at the last column when the line is full. */
+	t->col = (end < t->cols) ? end : (t->cols - 1);
+}
+
+
+static void terminal_putc(struct terminal *t, char c) {
+	t->bytes++;
+
+	if (t->escape == TERMINAL_ESC_ESC) {
+		t->escape = (c == '[') ? TERMINAL_ESC_CSI : TERMINAL_ESC_NONE;
+		t->param = 0;
+		t->private = 0;
+		return;
+	}
+
+	if (t->escape == TERMINAL_ESC_CSI) {
+		if (c >= '0' && c <= '9') {
+			t->param = t->param * 10 + (c - '0');
+		} else if (c == '?') {
+			t->private = 1;
+		} else if (c >= 0x40 && c <= 0x7e) {
+			terminal_csi(t, c);
+			t->escape = TERMINAL_ESC_NONE;
+		}
+		return;
+	}
+
+	/* Collect bytes of UTF-8 encoded characters. */
+	unsigned char u = c;
+	if (u >= 0x80) {
+		if ((u & 0xc0) != 0x80) {
+			t->utf8_len = 0;
+			t->utf8_need = (u >= 0xf0) ? 4 : (u >= 0xe0) ? 3 : 2;
+		} else if (t->utf8_len == 0) {
+			return;
+		}
+		t->utf8[t->utf8_len++] = c;
+		if (t->utf8_len == t->utf8_need) {
+			terminal_put(t, t->utf8, t->utf8_len);
+			t->utf8_len = 0;
+		}
+		return;
+	}
+	t->utf8_len = 0;
+
+	switch (c) {
+		case 0x1b:
+			t->escape = TERMINAL_ESC_ESC;
+			break;
+		case '\r':
+			t->col = 0;
+			break;
+		case '\n':
+			terminal_newline(t);
+			break;
+		default:
+			if (u < 32) {
+				break;
+			}
+			terminal_put(t, &c, 1);
+			break;
+	}
+}
+
+
+int32_t terminal_print(const char *line, void *ctx) {
+	struct terminal *t = (struct terminal *)ctx;
+	if (t == NULL || line == NULL) {
+		return TERMINAL_PRINT_FAILED;
+	}
+
+	t->calls++;
+	while (*line) {
+		terminal_putc(t, *line);
+		line++;
+	}
+
+	return TERMINAL_PRINT_OK;
+}
+
+
+int32_t terminal_get_row(struct terminal *t, uint32_t row, char *s) {
+	if (t == NULL || s == NULL || row >= t->rows) {
+		return TERMINAL_GET_ROW_FAILED;
+	}
+
+	uint32_t len = 0;
+	for (uint32_t col = 0; col < t->cols; col++) {
+		const char *cell = terminal_cell(t, row, col);
+		uint32_t n = strlen(cell);
+		memcpy(s + len, cell, n);
+		len += n;
+	}
+	while (len > 0 && s[len - 1] == ' ') {
+		len--;
+	}
+	s[len] = '\0';
+
+	return TERMINAL_GET_ROW_OK;
+}
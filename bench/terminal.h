@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) 2014, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/**
+ * Size of a screen cell. It holds a single UTF-8 encoded character followed
+ * by combining marks, as many as fit. The second cell of a double width
+ * character is left empty.
+ */
+#define TERMINAL_CELL_SIZE 16
+
+/**
+ * Mock terminal emulating the subset of ANSI/VT100 output used by lineedit.
+ * It keeps a screen of @a rows lines, each @a cols characters wide, and
+ * counts all bytes and print handler calls it receives. Character widths
+ * are determined by wcwidth, LC_CTYPE must be set to an UTF-8 locale.
+ */
+struct terminal {
+	char *screen;
+	uint32_t rows;
+	uint32_t cols;
+
+	/**
+	 * Current and saved cursor position.
+	 */
+	uint32_t row;
+	uint32_t col;
+	uint32_t saved_row;
+	uint32_t saved_col;
+
+	/**
+	 * Escape sequence parser state, parameter of the sequence being
+	 * received and a flag set if it is a private one.
+	 */
+	uint32_t escape;
+	uint32_t param;
+	uint32_t private;
+
+	/**
+	 * UTF-8 encoded character being received.
+	 */
+	char utf8[4];
+	uint32_t utf8_len;
+	uint32_t utf8_need;
+
+	uint32_t bytes;
+	uint32_t calls;
+};
+
+
+int32_t terminal_init(struct terminal *t, uint32_t rows, uint32_t cols);
+#define TERMINAL_INIT_OK 0
+#define TERMINAL_INIT_FAILED -1
+
+int32_t terminal_free(struct terminal *t);
+#define TERMINAL_FREE_OK 0
+#define TERMINAL_FREE_FAILED -1
+
+/**
+ * @brief Print handler to be used with lineedit_set_print_handler.
+ *
+ * @param line String to be interpreted by the terminal.
+ * @param ctx Pointer to the terminal structure.
+ */
+int32_t terminal_print(const char *line, void *ctx);
+#define TERMINAL_PRINT_OK 0
+#define TERMINAL_PRINT_FAILED -1
+
+/**
+ * @brief Get contents of a screen row without trailing spaces.
+ *
+ * @param t Terminal. Cannot be NULL.
+ * @param row Row number.
+ * @param s Buffer for the row contents, at least
+ *          cols * TERMINAL_CELL_SIZE + 1 bytes long.
+ */
+int32_t terminal_get_row(struct terminal *t, uint32_t row, char *s);
+#define TERMINAL_GET_ROW_OK 0
+#define TERMINAL_GET_ROW_FAILED -1
@@ -3,11 +3,28 @@
 #include <string.h>
 
 #include "lineedit.h"
+#include "lineedit_history_file.h"
 
 
 /* Global variable holding reference to current command prompt. */
 const char *prompt;
 
+/* Commands completed when TAB is pressed. Sub-commands are separated by
+ * a single space. */
+const char *commands[] = {
+	"help",
+	"quit",
+	"show interfaces",
+	"show ip route",
+	"show version",
+	"set prompt",
+};
+#define COMMAND_COUNT (sizeof(commands) / sizeof(commands[0]))
+
+/* Completion trie is built in these arrays. */
+struct lineedit_trie_node trie_nodes[LINEEDIT_TRIE_NODES(COMMAND_COUNT)];
+char trie_labels[64];
+
 
 /* Output function (print handler) provides a way to output data back to
  * console/terminal */
@@ -17,35 +34,70 @@ int32_t output(const char *s, void *ctx) {
 }
 
 
-/* This callback function is called every time a command prompt output
- * is requested. We are printing global prompt variable to demonstrate
- * this functionality. You can use ctx parameter to get the context in which
- * the callback was called. */
+/* This callback function is called when a command prompt has to be
+ * rendered. Its output is cached and reused by every redraw until
+ * lineedit_invalidate_prompt is called. We are printing global prompt
+ * variable to demonstrate this functionality. You can use ctx parameter to
+ * get the context in which the callback was called. */
 int32_t prompt_callback(struct lineedit *le, void *ctx) {
-	/* TODO: nicer API will be provided later */
+	/* Always print using lineedit functions, output buffer is used. */
 	lineedit_escape_print(le, ESC_COLOR, LINEEDIT_FG_COLOR_GREEN);
-	le->print_handler(prompt, le->print_handler_ctx);
+	lineedit_print(le, prompt);
 	lineedit_escape_print(le, ESC_DEFAULT, 0);
 
-	return 0;
+	/* Return the prompt width. It is measured from the cached output too,
+	 * escape sequences are not counted. */
+	return strlen(prompt);
 }
 
 int main(int argc, char *argv[]) {
 
 	struct lineedit line;
 
+	/* Output of every keypress is collected here and printed at once. */
+	static char output_buffer[64];
+
 	/* Initialize line editor. Return value checking ommited for clarity.
-	 * This is the single point where dynamic allocation is used (malloc). */
+	 * This is the single point where dynamic allocation is used (malloc).
+	 * Use lineedit_init_static or LINEEDIT_STATIC_TYPE to avoid it. */
 	lineedit_init(&line, 20);
 	lineedit_set_print_handler(&line, output, NULL);
 	lineedit_set_prompt_callback(&line, prompt_callback, NULL);
+	lineedit_set_output_buffer(&line, output_buffer, sizeof(output_buffer));
+
+	/* Build the completion trie once, it can be shared by multiple line
+	 * editors. */
+	struct lineedit_trie trie;
+	lineedit_trie_build(&trie, trie_nodes, LINEEDIT_TRIE_NODES(COMMAND_COUNT), trie_labels, sizeof(trie_labels), commands, COMMAND_COUNT);
+	lineedit_set_completion(&line, &trie);
+
+	/* History is kept in a file and survives restarts. It is optional and
+	 * needs a POSIX system. */
+	struct lineedit_history_file history;
+	lineedit_history_file_open(&history, &line, "example1.history", 4096);
+
+	/* Edits of the current line can be undone (Ctrl+_) and redone (Ctrl+Y).
+	 * The buffer limits how many of them are remembered. */
+	static uint8_t undo_buffer[256];
+	lineedit_set_undo_buffer(&line, undo_buffer, sizeof(undo_buffer));
+
+	/* The most recent history entry starting with the typed text is
+	 * suggested after the cursor, Right or End accepts it. */
+	static uint32_t hint_index[LINEEDIT_HINT_INDEX_LEN(64)];
+	lineedit_set_hint_index(&line, hint_index, 64);
 
 	/* If you want to hide typed characters, set pwchar to nonzero value.
 	 * nicer API will be provided later. */
 	/* line.pwchar = '*'; */
 
-	/* Set the command prompt. It will be used in the prompt callback function */
+	/* In the multi-line mode, Ctrl+J inserts a newline and following rows
+	 * start with the continuation prompt. */
+	/* lineedit_set_multiline(&line, 1, "... "); */
+
+	/* Set the command prompt. It will be used in the prompt callback function,
+	 * the cached prompt has to be invalidated whenever it is changed. */
 	prompt = "prompt > ";
+	lineedit_invalidate_prompt(&line);
 
 	/* Repeat line editation until "quit" is entered. */
 	while (1) {
@@ -80,6 +132,11 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	/* Compact the history file to make the next start faster and close it
+	 * before the editor is freed. */
+	lineedit_history_file_compact(&history);
+	lineedit_history_file_close(&history);
+
 	/* Do not forget to free the whole thing */
 	lineedit_free(&line);
 }
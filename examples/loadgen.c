@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+/* Load generator for the server example. It opens a number of connections
+ * and replays typing on all of them. Every keystroke is sent only after the
+ * response to the previous one arrives. Latency of the responses is measured
+ * and its percentiles are printed at the end.
+ *
+ * Usage: loadgen [connections] [keystrokes per connection] [port] */
+
+#define LOADGEN_PORT 2323
+#define LOADGEN_MAX_EVENTS 256
+
+/* Typing replayed on every connection. */
+static const char *script =
+	"show interfaces\r"
+	"sho ip rotue\x7f\x7f\x7f" "ute\r"
+	"ping 10.0.0.1 count 5\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x7f" "2\r"
+	"\x1b[A\x1b[A\x1b[A\x01\x1b[3~\x1b[3~\x1b[3~\x1b[3~list\r";
+
+struct connection {
+	int fd;
+
+	/* Position in the script and number of keystrokes left. */
+	uint32_t pos;
+	uint32_t left;
+
+	/* Time when the last keystroke was sent or 0 if the connection waits
+	 * for the initial prompt. */
+	double sent;
+};
+
+static double *latencies;
+static uint64_t latencies_count;
+
+
+static double time_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int compare_double(const void *a, const void *b) {
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+
+/* Send the next key of the script. Escape sequences are sent at once as
+ * a terminal would do. */
+static int32_t connection_send(struct connection *c) {
+	uint32_t len = strlen(script);
+	uint32_t n = 1;
+
+	if (script[c->pos] == 0x1b && script[c->pos + 1] == '[') {
+		/* Find the final byte of the CSI sequence. */
+		n = 2;
+		while ((c->pos + n) < len && !(script[c->pos + n] >= 0x40 && script[c->pos + n] <= 0x7e)) {
+			n++;
+		}
+		n++;
+	}
+
+	c->sent = time_now();
+	if (write(c->fd, script + c->pos, n) != (ssize_t)n) {
+		return -1;
+	}
+	c->pos = (c->pos + n) % len;
+	c->left--;
+
+	return 0;
+}
+
+
+/* Read the response. Returns nonzero if the connection should be closed. */
+static int32_t connection_receive(struct connection *c) {
+	char buf[4096];
+	int32_t received = 0;
+
+	while (1) {
+		ssize_t ret = read(c->fd, buf, sizeof(buf));
+		if (ret == 0) {
+			return 1;
+		}
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				return 1;
+			}
+			break;
+		}
+		received = 1;
+	}
+
+	if (!received) {
+		return 0;
+	}
+
+	if (c->sent > 0.0) {
+		latencies[latencies_count++] = time_now() - c->sent;
+	}
+	if (c->left == 0) {
+		return 1;
+	}
+
+	return connection_send(c);
+}
+
+
+static int connection_open(uint16_t port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	/* Keystrokes are small, do not wait to coalesce them. */
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+
+	return fd;
+}
+
+
+int main(int argc, char *argv[]) {
+	uint32_t count = (argc > 1) ? atoi(argv[1]) : 1000;
+	uint32_t keys = (argc > 2) ? atoi(argv[2]) : 200;
+	uint16_t port = (argc > 3) ? atoi(argv[3]) : LOADGEN_PORT;
+
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	struct connection *conns = calloc(count, sizeof(struct connection));
+	latencies = calloc((uint64_t)count * keys, sizeof(double));
+	if (conns == NULL || latencies == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	int epfd = epoll_create1(0);
+	for (uint32_t i = 0; i < count; i++) {
+		conns[i].fd = connection_open(port);
+		if (conns[i].fd < 0) {
+			perror("connect");
+			return 1;
+		}
+		conns[i].left = keys;
+
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &conns[i]};
+		epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+	}
+
+	double start = time_now();
+	uint32_t active = count;
+	while (active > 0) {
+		struct epoll_event events[LOADGEN_MAX_EVENTS];
+		int n = epoll_wait(epfd, events, LOADGEN_MAX_EVENTS, -1);
+
+		for (int i = 0; i < n; i++) {
+			struct connection *c = events[i].data.ptr;
+			if (connection_receive(c)) {
+				epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+				close(c->fd);
+				active--;
+			}
+		}
+	}
+	double elapsed = time_now() - start;
+
+	qsort(latencies, latencies_count, sizeof(double), compare_double);
+	printf("connections %u, keystrokes %llu in %.2f s (%.0f/s)\n",
+		count, (unsigned long long)latencies_count, elapsed, latencies_count / elapsed);
+
+	if (latencies_count > 0) {
+		const double percentiles[] = {50.0, 90.0, 99.0, 99.9, 100.0};
+		printf("latency");
+		for (uint32_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+			uint64_t index = (uint64_t)(percentiles[i] / 100.0 * (latencies_count - 1));
+			printf(" p%g %.1f us%s", percentiles[i], latencies[index] * 1e6,
+				(i + 1 < sizeof(percentiles) / sizeof(percentiles[0])) ? "," : "\n");
+		}
+	}
+
+	free(latencies);
+	free(conns);
+
+	return 0;
+}
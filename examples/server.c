@@ -0,0 +1,480 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+
+#include "lineedit.h"
+
+/* Multi-session server example. Every TCP connection gets its own lineedit
+ * context, all of them are served by a single thread using epoll. Connect
+ * using "telnet localhost 2323" or use loadgen to generate load.
+ *
+ * Usage: server [port] */
+
+#define SERVER_PORT 2323
+#define SERVER_LINE_LEN 128
+#define SERVER_HISTORY_ENTRIES 256
+#define SERVER_OUTPUT_BUFFER_SIZE 1024
+#define SERVER_READ_SIZE 1024
+#define SERVER_MAX_EVENTS 256
+#define SERVER_STATS_INTERVAL 5
+
+/* Telnet commands used to negotiate character mode and the window size
+ * with telnet clients. */
+#define TELNET_IAC 255
+#define TELNET_SB 250
+#define TELNET_SE 240
+#define TELNET_WILL 251
+#define TELNET_DO 253
+#define TELNET_DONT 254
+#define TELNET_NAWS 31
+
+enum telnet_state {
+	TELNET_DATA,
+	TELNET_CR,
+	TELNET_COMMAND,
+	TELNET_OPTION,
+	TELNET_SUBNEGOTIATION,
+	TELNET_SUBNEGOTIATION_IAC,
+};
+
+struct session {
+	int fd;
+
+	/* Editor buffers are a part of the session, no other allocation is
+	 * needed for it. The history is shared by all sessions, the own
+	 * history arena only needs to hold a single line. */
+	struct lineedit le;
+	uint8_t storage[LINEEDIT_STORAGE_SIZE(SERVER_LINE_LEN, 0)];
+
+	/* All output of a single keypress is collected here. It is also used
+	 * by lineedit as a send queue if the socket is not able to accept
+	 * everything. */
+	char output_buffer[SERVER_OUTPUT_BUFFER_SIZE];
+	uint32_t epollout;
+
+	enum telnet_state telnet;
+
+	/* Option and parameters of the subnegotiation being received. */
+	uint8_t sb[5];
+	uint32_t sb_len;
+};
+
+static int epfd;
+
+/* Lines entered in any session can be recalled in all of them. */
+static struct lineedit_shared_history history;
+static uint8_t history_storage[LINEEDIT_SHARED_HISTORY_SIZE(SERVER_LINE_LEN, SERVER_HISTORY_ENTRIES)];
+
+/* Server statistics. */
+static uint32_t sessions;
+static uint64_t keystrokes;
+static uint64_t dropped;
+static size_t heap_base;
+
+
+static double time_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static double cpu_time(void) {
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+
+/* Print handler of every session. Output is written to the socket directly.
+ * If the socket cannot accept everything, the number of unsent bytes is
+ * returned and lineedit keeps them until lineedit_output_resume is called. */
+static int32_t session_output(const char *str, void *ctx) {
+	struct session *s = (struct session *)ctx;
+	size_t len = strlen(str);
+	size_t sent = 0;
+
+	while (sent < len) {
+		ssize_t ret = send(s->fd, str + sent, len - sent, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			/* Socket is full. Errors are detected when reading. */
+			break;
+		}
+		sent += ret;
+	}
+
+	return len - sent;
+}
+
+
+/* Wait for the socket to become writable if lineedit has some unsent
+ * output. */
+static void session_poll_output(struct session *s) {
+	uint32_t epollout = (lineedit_output_pending(&s->le, NULL) == LINEEDIT_OUTPUT_PENDING_BLOCKED);
+
+	if (epollout != s->epollout) {
+		struct epoll_event ev = {
+			.events = EPOLLIN | (epollout ? EPOLLOUT : 0),
+			.data.ptr = s
+		};
+		epoll_ctl(epfd, EPOLL_CTL_MOD, s->fd, &ev);
+		s->epollout = epollout;
+	}
+}
+
+
+static int32_t session_prompt(struct lineedit *le, void *ctx) {
+	const char *prompt = "server > ";
+
+	lineedit_escape_print(le, ESC_COLOR, LINEEDIT_FG_COLOR_GREEN);
+	lineedit_print(le, prompt);
+	lineedit_escape_print(le, ESC_DEFAULT, 0);
+
+	return strlen(prompt);
+}
+
+
+static struct session *session_new(int fd) {
+	struct session *s = calloc(1, sizeof(struct session));
+	if (s == NULL) {
+		return NULL;
+	}
+	s->fd = fd;
+
+	if (lineedit_init_static(&s->le, SERVER_LINE_LEN, s->storage, sizeof(s->storage)) != LINEEDIT_INIT_STATIC_OK) {
+		free(s);
+		return NULL;
+	}
+	lineedit_set_print_handler(&s->le, session_output, s);
+	lineedit_set_prompt_callback(&s->le, session_prompt, NULL);
+	lineedit_set_output_buffer(&s->le, s->output_buffer, sizeof(s->output_buffer));
+	lineedit_set_shared_history(&s->le, &history);
+
+	/* Ask telnet clients to switch to character mode without local echo
+	 * and to report the window size. Long lines are scrolled then. */
+	const char negotiate[] = {
+		TELNET_IAC, TELNET_WILL, 1,
+		TELNET_IAC, TELNET_WILL, 3,
+		TELNET_IAC, TELNET_DO, TELNET_NAWS,
+		0
+	};
+	lineedit_print(&s->le, negotiate);
+
+	lineedit_refresh(&s->le);
+
+	return s;
+}
+
+
+static void session_free(struct session *s) {
+	struct lineedit_stats stats;
+	if (lineedit_get_stats(&s->le, &stats) == LINEEDIT_GET_STATS_OK) {
+		dropped += stats.dropped;
+	}
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+	close(s->fd);
+	lineedit_free(&s->le);
+	free(s);
+	sessions--;
+}
+
+
+/* Handle a finished telnet subnegotiation. The window width is passed to
+ * the line editor. */
+static void session_telnet_subnegotiation(struct session *s) {
+	if (s->sb_len == sizeof(s->sb) && s->sb[0] == TELNET_NAWS) {
+		lineedit_set_width(&s->le, (s->sb[1] << 8) | s->sb[2]);
+		lineedit_refresh(&s->le);
+	}
+}
+
+
+/* Remove telnet commands from the input. Line endings sent as CR LF or
+ * CR NUL are reduced to a single CR. Returns the new length of @a buf. */
+static uint32_t session_telnet_filter(struct session *s, char *buf, uint32_t len) {
+	uint32_t out = 0;
+
+	for (uint32_t i = 0; i < len; i++) {
+		uint8_t c = buf[i];
+
+		switch (s->telnet) {
+			case TELNET_CR:
+				s->telnet = TELNET_DATA;
+				if (c == '\n' || c == '\0') {
+					break;
+				}
+				/* Fall through. */
+			case TELNET_DATA:
+				if (c == TELNET_IAC) {
+					s->telnet = TELNET_COMMAND;
+				} else {
+					if (c == '\r') {
+						s->telnet = TELNET_CR;
+					}
+					buf[out++] = c;
+				}
+				break;
+			case TELNET_COMMAND:
+				if (c == TELNET_IAC) {
+					buf[out++] = c;
+					s->telnet = TELNET_DATA;
+				} else if (c == TELNET_SB) {
+					s->telnet = TELNET_SUBNEGOTIATION;
+					s->sb_len = 0;
+				} else if (c >= TELNET_WILL && c <= TELNET_DONT) {
+					s->telnet = TELNET_OPTION;
+				} else {
+					s->telnet = TELNET_DATA;
+				}
+				break;
+			case TELNET_OPTION:
+				s->telnet = TELNET_DATA;
+				break;
+			case TELNET_SUBNEGOTIATION:
+				if (c == TELNET_IAC) {
+					s->telnet = TELNET_SUBNEGOTIATION_IAC;
+				} else if (s->sb_len < sizeof(s->sb)) {
+					s->sb[s->sb_len++] = c;
+				}
+				break;
+			case TELNET_SUBNEGOTIATION_IAC:
+				if (c == TELNET_SE) {
+					s->telnet = TELNET_DATA;
+					session_telnet_subnegotiation(s);
+					break;
+				}
+				/* IAC is doubled inside the subnegotiation. */
+				if (c == TELNET_IAC && s->sb_len < sizeof(s->sb)) {
+					s->sb[s->sb_len++] = c;
+				}
+				s->telnet = TELNET_SUBNEGOTIATION;
+				break;
+		}
+	}
+
+	return out;
+}
+
+
+static void stats_print(struct lineedit *le, double elapsed, double cpu) {
+	char line[160];
+	struct mallinfo2 mi = mallinfo2();
+
+	snprintf(line, sizeof(line),
+		"sessions %u, memory/session %zu B, keystrokes %llu (%.0f/s), cpu/keystroke %.2f us, dropped %llu B",
+		sessions,
+		sessions ? (mi.uordblks - heap_base) / sessions : 0,
+		(unsigned long long)keystrokes,
+		elapsed > 0.0 ? keystrokes / elapsed : 0.0,
+		keystrokes ? cpu * 1e6 / keystrokes : 0.0,
+		(unsigned long long)dropped
+	);
+
+	if (le != NULL) {
+		lineedit_print(le, line);
+		lineedit_print(le, "\r\n");
+	} else {
+		printf("%s\n", line);
+		fflush(stdout);
+	}
+}
+
+
+/* Handle a finished line. Returns nonzero if the session should be closed. */
+static int32_t session_command(struct session *s) {
+	char *text;
+	lineedit_get_line(&s->le, &text);
+
+	lineedit_print(&s->le, "\r\n");
+	if (!strcmp(text, "quit")) {
+		return 1;
+	} else if (!strcmp(text, "stats")) {
+		stats_print(&s->le, 0.0, 0.0);
+	} else if (text[0] != '\0') {
+		lineedit_print(&s->le, "ok: ");
+		lineedit_print(&s->le, text);
+		lineedit_print(&s->le, "\r\n");
+	}
+
+	lineedit_clear(&s->le);
+	lineedit_refresh(&s->le);
+
+	return 0;
+}
+
+
+/* Read and process all available input. Returns nonzero if the session
+ * should be closed. */
+static int32_t session_input(struct session *s) {
+	char buf[SERVER_READ_SIZE];
+
+	while (1) {
+		ssize_t ret = read(s->fd, buf, sizeof(buf));
+		if (ret == 0) {
+			return 1;
+		}
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+			if (errno == EINTR) {
+				continue;
+			}
+			return 1;
+		}
+
+		uint32_t len = session_telnet_filter(s, buf, ret);
+		keystrokes += len;
+
+		/* lineedit_feed stops after every finished line. */
+		uint32_t pos = 0;
+		while (pos < len) {
+			uint32_t consumed = 0;
+			int32_t r = lineedit_feed(&s->le, buf + pos, len - pos, &consumed);
+			pos += consumed;
+
+			if (r == LINEEDIT_ENTER && session_command(s)) {
+				return 1;
+			}
+			if (r == LINEEDIT_FAILED) {
+				return 1;
+			}
+		}
+	}
+}
+
+
+static int listen_socket(uint16_t port) {
+	int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1024) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+static void accept_sessions(int lfd) {
+	while (1) {
+		int fd = accept4(lfd, NULL, NULL, SOCK_NONBLOCK);
+		if (fd < 0) {
+			return;
+		}
+
+		struct session *s = session_new(fd);
+		if (s == NULL) {
+			close(fd);
+			continue;
+		}
+		sessions++;
+
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = s};
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+		session_poll_output(s);
+	}
+}
+
+
+int main(int argc, char *argv[]) {
+	uint16_t port = (argc > 1) ? atoi(argv[1]) : SERVER_PORT;
+
+	/* Thousands of sessions need more file descriptors than usual. */
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
+	int lfd = listen_socket(port);
+	if (lfd < 0) {
+		perror("listen");
+		return 1;
+	}
+
+	lineedit_shared_history_init(&history, SERVER_LINE_LEN, history_storage, sizeof(history_storage));
+
+	epfd = epoll_create1(0);
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+	heap_base = mallinfo2().uordblks;
+	printf("listening on port %u\n", port);
+	fflush(stdout);
+
+	double start = time_now();
+	double cpu_start = cpu_time();
+	double next_stats = start + SERVER_STATS_INTERVAL;
+	uint64_t last_keystrokes = 0;
+
+	while (1) {
+		struct epoll_event events[SERVER_MAX_EVENTS];
+		int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, 1000);
+
+		for (int i = 0; i < n; i++) {
+			struct session *s = events[i].data.ptr;
+			if (s == NULL) {
+				accept_sessions(lfd);
+				continue;
+			}
+
+			int32_t close_session = 0;
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				close_session = 1;
+			}
+			/* Send the queued output and the final redraw first. */
+			if (!close_session && (events[i].events & EPOLLOUT)) {
+				lineedit_output_resume(&s->le);
+			}
+			if (!close_session && (events[i].events & EPOLLIN)) {
+				close_session = session_input(s);
+			}
+			if (close_session) {
+				session_free(s);
+			} else {
+				session_poll_output(s);
+			}
+		}
+
+		/* Print statistics periodically if there was some activity. */
+		double now = time_now();
+		if (now >= next_stats) {
+			if (keystrokes != last_keystrokes) {
+				stats_print(NULL, now - start, cpu_time() - cpu_start);
+				last_keystrokes = keystrokes;
+			}
+			next_stats = now + SERVER_STATS_INTERVAL;
+		}
+	}
+
+	return 0;
+}
@@ -33,15 +33,710 @@
 #include "lineedit.h"
 
 
+#if LINEEDIT_STATS
+#define LINEEDIT_STAT_ADD(le, counter, n) ((le)->stats.counter += (n))
+#else
+#define LINEEDIT_STAT_ADD(le, counter, n)
+#endif
+
+
+/* Output is held in the staging buffer while any lineedit operation is
+ * running. The outermost operation flushes it when finished, this way every
+ * operation ends with a single print handler call. */
+static void lineedit_output_hold(struct lineedit *le) {
+	le->out_hold++;
+}
+
+
+/* Release the output without flushing it, it stays staged until the next
+ * flush. */
+static void lineedit_output_unhold(struct lineedit *le) {
+	if (le->out_hold > 0) {
+		le->out_hold--;
+	}
+}
+
+
+static void lineedit_output_release(struct lineedit *le) {
+	lineedit_output_unhold(le);
+	if (le->out_hold == 0) {
+		lineedit_flush(le);
+	}
+}
+
+
+/* Pass @a n bytes of zero terminated @a s to the print handler. Returns the
+ * number of bytes at the end of @a s it was not able to write. */
+static uint32_t lineedit_output_send(struct lineedit *le, const char *s, uint32_t n) {
+	int32_t ret = le->print_handler(s, le->print_handler_ctx);
+	uint32_t left = (ret > 0 && (uint32_t)ret <= n) ? (uint32_t)ret : 0;
+
+	LINEEDIT_STAT_ADD(le, print_calls, 1);
+	LINEEDIT_STAT_ADD(le, bytes, n - left);
+	if (left > 0) {
+		le->out_blocked = 1;
+	}
+
+	return left;
+}
+
+
+/* Output of @a n bytes was dropped as there is no space to queue it until the
+ * print handler is able to write again. Terminal contents are not known,
+ * the whole line is redrawn when the output is resumed. */
+static void lineedit_output_drop(struct lineedit *le, uint32_t n) {
+	LINEEDIT_STAT_ADD(le, dropped, n);
+	le->shadow_valid = 0;
+	le->redraw_pending = 1;
+}
+
+
+/* States of the prompt cache. Output is captured into the cache while the
+ * prompt callback is rendering it. */
+#define LINEEDIT_PROMPT_INVALID 0
+#define LINEEDIT_PROMPT_RENDERING 1
+#define LINEEDIT_PROMPT_CACHED 2
+
+/* Write @a n bytes of @a s (not necessarily zero terminated) to the output. */
+static int32_t lineedit_write(struct lineedit *le, const char *s, uint32_t n) {
+	if (u_assert(le->print_handler != NULL)) {
+		return LINEEDIT_PRINT_FAILED;
+	}
+
+	if (le->prompt_state == LINEEDIT_PROMPT_RENDERING) {
+		if ((le->prompt_cache_len + n) <= sizeof(le->prompt_cache)) {
+			memcpy(le->prompt_cache + le->prompt_cache_len, s, n);
+			le->prompt_cache_len += n;
+		} else {
+			/* Too long to be cached, it is rendered every time. */
+			le->prompt_state = LINEEDIT_PROMPT_INVALID;
+		}
+	}
+
+	if (le->out_buf == NULL) {
+		/* No staging buffer, print in small chunks directly. Nothing can
+		 * be queued if the print handler is blocked. */
+		if (le->out_blocked) {
+			lineedit_output_drop(le, n);
+			return LINEEDIT_PRINT_FAILED;
+		}
+		char chunk[32];
+		while (n > 0) {
+			uint32_t l = (n < sizeof(chunk)) ? n : (sizeof(chunk) - 1);
+			memcpy(chunk, s, l);
+			chunk[l] = '\0';
+			uint32_t left = lineedit_output_send(le, chunk, l);
+			s += l;
+			n -= l;
+			if (left > 0) {
+				lineedit_output_drop(le, left + n);
+				return LINEEDIT_PRINT_FAILED;
+			}
+		}
+		return LINEEDIT_PRINT_OK;
+	}
+
+	/* Every write would be a separate print handler call without the
+	 * buffer. Flushes below are subtracted again. */
+	le->out_saved++;
+	while (n > 0) {
+		uint32_t space = le->out_size - 1 - le->out_used;
+		if (le->out_blocked && n > space) {
+			/* The buffer is used as a queue of unsent output while the
+			 * print handler is blocked and it is full. */
+			lineedit_output_drop(le, n);
+			return LINEEDIT_PRINT_FAILED;
+		}
+		if (space == 0) {
+			lineedit_flush(le);
+			continue;
+		}
+		uint32_t l = (n < space) ? n : space;
+		memcpy(le->out_buf + le->out_used, s, l);
+		le->out_used += l;
+		s += l;
+		n -= l;
+	}
+
+	return LINEEDIT_PRINT_OK;
+}
+
+
+/* Move the gap of the line buffer to position @a pos. Characters between
+ * the old and the new position are moved to the other side of the gap. */
+static void lineedit_gap_move(struct lineedit *le, uint32_t pos) {
+	if (pos < le->gap_start) {
+		uint32_t n = le->gap_start - pos;
+		memmove(le->text + le->gap_end - n, le->text + pos, n);
+		le->gap_start -= n;
+		le->gap_end -= n;
+	} else if (pos > le->gap_start) {
+		uint32_t n = pos - le->gap_start;
+		memmove(le->text + le->gap_start, le->text + le->gap_end, n);
+		le->gap_start += n;
+		le->gap_end += n;
+	}
+}
+
+
+/* Get a contiguous part of the line starting at @a from and ending at @a to
+ * or at the gap, whichever comes first. Returns its length. */
+static uint32_t lineedit_text_span(struct lineedit *le, uint32_t from, uint32_t to, const char **s) {
+	if (from < le->gap_start) {
+		*s = le->text + from;
+		return ((to < le->gap_start) ? to : le->gap_start) - from;
+	}
+	*s = le->text + le->gap_end + (from - le->gap_start);
+	return to - from;
+}
+
+
+/* Get character at position @a pos of the line. */
+static char lineedit_text_char(struct lineedit *le, uint32_t pos) {
+	if (pos < le->gap_start) {
+		return le->text[pos];
+	}
+	return le->text[le->gap_end + (pos - le->gap_start)];
+}
+
+
+/* Position of the beginning of the word left to the cursor. */
+static uint32_t lineedit_word_left(struct lineedit *le) {
+	uint32_t pos = le->cursor;
+	while (pos > 0 && lineedit_text_char(le, pos - 1) == ' ') {
+		pos--;
+	}
+	while (pos > 0 && lineedit_text_char(le, pos - 1) != ' ') {
+		pos--;
+	}
+	return pos;
+}
+
+
+/* Position of the end of the word right to the cursor. */
+static uint32_t lineedit_word_right(struct lineedit *le) {
+	uint32_t pos = le->cursor;
+	while (pos < le->text_len && lineedit_text_char(le, pos) == ' ') {
+		pos++;
+	}
+	while (pos < le->text_len && lineedit_text_char(le, pos) != ' ') {
+		pos++;
+	}
+	return pos;
+}
+
+
+/* Bytes 10xxxxxx continue a multibyte UTF-8 character. */
+#define LINEEDIT_UTF8_CONT(c) (((uint8_t)(c) & 0xc0) == 0x80)
+
+/* Decode the UTF-8 character at the beginning of @a s, @a len bytes are
+ * available. Returns its length. ASCII characters, invalid and incomplete
+ * sequences are 1 byte long, @a cp is set to the byte value then. */
+static uint32_t lineedit_utf8_decode(const char *s, uint32_t len, uint32_t *cp) {
+	const uint8_t *u = (const uint8_t *)s;
+	uint32_t n;
+	uint32_t c;
+
+	*cp = u[0];
+	if (u[0] >= 0xc2 && u[0] <= 0xdf) {
+		n = 2;
+		c = u[0] & 0x1f;
+	} else if (u[0] >= 0xe0 && u[0] <= 0xef) {
+		n = 3;
+		c = u[0] & 0x0f;
+	} else if (u[0] >= 0xf0 && u[0] <= 0xf4) {
+		n = 4;
+		c = u[0] & 0x07;
+	} else {
+		return 1;
+	}
+	if (n > len) {
+		return 1;
+	}
+	for (uint32_t i = 1; i < n; i++) {
+		if (!LINEEDIT_UTF8_CONT(u[i])) {
+			return 1;
+		}
+		c = (c << 6) | (u[i] & 0x3f);
+	}
+
+	/* Reject overlong forms, surrogates and values above U+10FFFF. */
+	if ((n == 3 && (c < 0x800 || (c >= 0xd800 && c <= 0xdfff))) ||
+	    (n == 4 && (c < 0x10000 || c > 0x10ffff))) {
+		return 1;
+	}
+	*cp = c;
+
+	return n;
+}
+
+
+struct lineedit_range {
+	uint32_t first;
+	uint32_t last;
+};
+
+/* The most common combining marks and other characters not occupying any
+ * column. */
+static const struct lineedit_range lineedit_zero_width[] = {
+	{0x0300, 0x036f}, {0x0483, 0x0489}, {0x0591, 0x05bd}, {0x05bf, 0x05bf},
+	{0x05c1, 0x05c2}, {0x05c4, 0x05c5}, {0x05c7, 0x05c7}, {0x0610, 0x061a},
+	{0x064b, 0x065f}, {0x0670, 0x0670}, {0x06d6, 0x06dc}, {0x06df, 0x06e4},
+	{0x06e7, 0x06e8}, {0x06ea, 0x06ed}, {0x0e31, 0x0e31}, {0x0e34, 0x0e3a},
+	{0x0e47, 0x0e4e}, {0x1ab0, 0x1aff}, {0x1dc0, 0x1dff}, {0x200b, 0x200f},
+	{0x20d0, 0x20ff}, {0xfe00, 0xfe0f}, {0xfe20, 0xfe2f}, {0xe0100, 0xe01ef},
+};
+
+/* East Asian wide and fullwidth characters and emoji taking two columns. */
+static const struct lineedit_range lineedit_wide[] = {
+	{0x1100, 0x115f}, {0x2e80, 0x303e}, {0x3041, 0x33ff}, {0x3400, 0x4dbf},
+	{0x4e00, 0x9fff}, {0xa000, 0xa4cf}, {0xac00, 0xd7a3}, {0xf900, 0xfaff},
+	{0xfe30, 0xfe4f}, {0xff00, 0xff60}, {0xffe0, 0xffe6}, {0x1f300, 0x1f64f},
+	{0x1f900, 0x1f9ff}, {0x20000, 0x2fffd}, {0x30000, 0x3fffd},
+};
+
+
+static uint32_t lineedit_in_ranges(const struct lineedit_range *r, uint32_t count, uint32_t cp) {
+	uint32_t lo = 0;
+	uint32_t hi = count;
+
+	while (lo < hi) {
+		uint32_t mid = (lo + hi) / 2;
+		if (cp < r[mid].first) {
+			hi = mid;
+		} else if (cp > r[mid].last) {
+			lo = mid + 1;
+		} else {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* Number of terminal columns taken by character @a cp. */
+static uint32_t lineedit_char_width(uint32_t cp) {
+	if (cp < 0x300) {
+		return 1;
+	}
+	if (lineedit_in_ranges(lineedit_zero_width, sizeof(lineedit_zero_width) / sizeof(lineedit_zero_width[0]), cp)) {
+		return 0;
+	}
+	if (lineedit_in_ranges(lineedit_wide, sizeof(lineedit_wide) / sizeof(lineedit_wide[0]), cp)) {
+		return 2;
+	}
+	return 1;
+}
+
+
+/* Number of columns taken by @a n bytes of UTF-8 text. Invalid bytes are
+ * displayed as replacement characters taking a single column. */
+static uint32_t lineedit_width(const char *s, uint32_t n) {
+	uint32_t w = 0;
+	uint32_t i = 0;
+
+	while (i < n) {
+		if ((uint8_t)s[i] < 0x80) {
+			w++;
+			i++;
+			continue;
+		}
+		uint32_t cp;
+		i += lineedit_utf8_decode(s + i, n - i, &cp);
+		w += lineedit_char_width(cp);
+	}
+
+	return w;
+}
+
+
+/* Number of columns taken by the last row of @a n bytes of terminal output.
+ * Escape sequences and other control characters take no space. */
+static uint32_t lineedit_output_width(const char *s, uint32_t n) {
+	uint32_t w = 0;
+	uint32_t i = 0;
+
+	while (i < n) {
+		uint8_t c = s[i];
+		if (c == 0x1b && (i + 1) < n && s[i + 1] == '[') {
+			/* CSI, parameters are ended by a final byte */
+			i += 2;
+			while (i < n && ((uint8_t)s[i] < 0x40 || (uint8_t)s[i] > 0x7e)) {
+				i++;
+			}
+			i++;
+		} else if (c == 0x1b && (i + 1) < n && s[i + 1] == ']') {
+			/* OSC (eg. a window title), ended by BEL or ST */
+			i += 2;
+			while (i < n && s[i] != 0x07 && s[i] != 0x1b) {
+				i++;
+			}
+			i += (i < n && s[i] == 0x1b) ? 2 : 1;
+		} else if (c == 0x1b) {
+			i += 2;
+		} else if (c == '\r' || c == '\n') {
+			w = 0;
+			i++;
+		} else if (c < 0x20 || c == 0x7f) {
+			i++;
+		} else {
+			uint32_t start = i;
+			while (i < n && (uint8_t)s[i] >= 0x20 && s[i] != 0x7f) {
+				i++;
+			}
+			w += lineedit_width(s + start, i - start);
+		}
+	}
+
+	return w;
+}
+
+
+/* Check if the character at the beginning of @a s (@a n bytes available) is
+ * displayed together with the preceding one. It is true for combining marks
+ * and continuation bytes. */
+static uint32_t lineedit_utf8_joins(const char *s, uint32_t n) {
+	if ((uint8_t)s[0] < 0x80) {
+		return 0;
+	}
+	uint32_t cp;
+	lineedit_utf8_decode(s, n, &cp);
+	return LINEEDIT_UTF8_CONT(s[0]) || lineedit_char_width(cp) == 0;
+}
+
+
+/* Length of the run of complete printable characters (ASCII or UTF-8) at
+ * the beginning of @a s. */
+static uint32_t lineedit_utf8_run(const char *s, uint32_t len) {
+	uint32_t i = 0;
+
+	while (i < len) {
+		if (s[i] >= 32 && s[i] <= 126) {
+			i++;
+			continue;
+		}
+		/* C1 control characters are not printable. */
+		uint32_t cp;
+		uint32_t n = lineedit_utf8_decode(s + i, len - i, &cp);
+		if (n == 1 || cp < 0xa0) {
+			break;
+		}
+		i += n;
+	}
+
+	return i;
+}
+
+
+/* Collect byte @a c of an UTF-8 encoded character. Returns the length of
+ * the character in @a utf8_seq when it is complete, 0 otherwise. Invalid
+ * sequences are dropped. */
+static uint32_t lineedit_utf8_collect(struct lineedit *le, int c) {
+	if (!LINEEDIT_UTF8_CONT(c)) {
+		le->utf8_len = 0;
+		le->utf8_need = (c >= 0xc2 && c <= 0xdf) ? 2 : (c >= 0xe0 && c <= 0xef) ? 3 : (c >= 0xf0 && c <= 0xf4) ? 4 : 0;
+		if (le->utf8_need > 0) {
+			le->utf8_seq[le->utf8_len++] = c;
+		}
+		return 0;
+	}
+	if (le->utf8_len == 0) {
+		return 0;
+	}
+
+	le->utf8_seq[le->utf8_len++] = c;
+	if (le->utf8_len < le->utf8_need) {
+		return 0;
+	}
+
+	uint32_t n = le->utf8_len;
+	uint32_t cp;
+	le->utf8_len = 0;
+	if (lineedit_utf8_decode((const char *)le->utf8_seq, n, &cp) != n || cp < 0xa0) {
+		return 0;
+	}
+
+	return n;
+}
+
+
+/* Decode the character at position @a pos of the line. Returns its length. */
+static uint32_t lineedit_text_decode(struct lineedit *le, uint32_t pos, uint32_t *cp) {
+	char c[4];
+	uint32_t n = 0;
+
+	while (n < sizeof(c) && (pos + n) < le->text_len) {
+		c[n] = lineedit_text_char(le, pos + n);
+		n++;
+	}
+
+	return lineedit_utf8_decode(c, n, cp);
+}
+
+
+/* Number of columns taken by the line between positions @a from and @a to. */
+static uint32_t lineedit_text_width(struct lineedit *le, uint32_t from, uint32_t to) {
+	uint32_t w = 0;
+
+	while (from < to) {
+		const char *s;
+		uint32_t n = lineedit_text_span(le, from, to, &s);
+		w += lineedit_width(s, n);
+		from += n;
+	}
+
+	return w;
+}
+
+
+/* Position of the character following the one at @a pos. Combining marks
+ * are kept together with the character they follow. */
+static uint32_t lineedit_next_char(struct lineedit *le, uint32_t pos) {
+	/* The line is plain ASCII. */
+	if (le->text_cols == le->text_len) {
+		return pos + 1;
+	}
+
+	uint32_t cp;
+	pos += lineedit_text_decode(le, pos, &cp);
+	while (pos < le->text_len) {
+		uint32_t n = lineedit_text_decode(le, pos, &cp);
+		if (lineedit_char_width(cp) > 0) {
+			break;
+		}
+		pos += n;
+	}
+
+	return pos;
+}
+
+
+/* Position of the character preceding position @a pos. */
+static uint32_t lineedit_prev_char(struct lineedit *le, uint32_t pos) {
+	if (le->text_cols == le->text_len) {
+		return pos - 1;
+	}
+
+	while (pos > 0) {
+		pos--;
+		while (pos > 0 && LINEEDIT_UTF8_CONT(lineedit_text_char(le, pos))) {
+			pos--;
+		}
+		uint32_t cp;
+		lineedit_text_decode(le, pos, &cp);
+		if (lineedit_char_width(cp) > 0) {
+			break;
+		}
+	}
+
+	return pos;
+}
+
+
+/* Move the cursor to position @a pos. Its column is updated using widths of
+ * the characters passed only. */
+static void lineedit_cursor_move(struct lineedit *le, uint32_t pos) {
+	if (le->text_cols == le->text_len) {
+		le->cursor_col = pos;
+	} else if (pos > le->cursor) {
+		le->cursor_col += lineedit_text_width(le, le->cursor, pos);
+	} else {
+		le->cursor_col -= lineedit_text_width(le, pos, le->cursor);
+	}
+	le->cursor = pos;
+}
+
+
+/* Remove characters between positions @a from and @a to. The cursor must be
+ * at one of them, it stays at @a from. */
+static void lineedit_remove(struct lineedit *le, uint32_t from, uint32_t to) {
+	uint32_t n = to - from;
+	uint32_t w = (le->text_cols == le->text_len) ? n : lineedit_text_width(le, from, to);
+
+	/* Extend the gap over the characters. */
+	if (le->cursor == to) {
+		lineedit_gap_move(le, to);
+		le->gap_start -= n;
+		le->cursor_col -= w;
+	} else {
+		lineedit_gap_move(le, from);
+		le->gap_end += n;
+	}
+	le->cursor = from;
+	le->text_len -= n;
+	le->text_cols -= w;
+}
+
+
+
 int32_t lineedit_print(struct lineedit *le, const char *s) {
 	if (u_assert(le != NULL) ||
+	    u_assert(s != NULL) ||
 	    u_assert(le->print_handler != NULL)) {
 		return LINEEDIT_PRINT_FAILED;
 	}
 
-	le->print_handler(s, le->print_handler_ctx);
+	lineedit_output_hold(le);
+	int32_t ret = lineedit_write(le, s, strlen(s));
+	lineedit_output_release(le);
 
-	return LINEEDIT_PRINT_OK;
+	return ret;
+}
+
+
+int32_t lineedit_set_output_buffer(struct lineedit *le, char *buf, uint32_t size) {
+	if (u_assert(le != NULL) ||
+	    u_assert(buf == NULL || size >= 2)) {
+		return LINEEDIT_SET_OUTPUT_BUFFER_FAILED;
+	}
+
+	/* Do not lose anything staged in the previous buffer. Output queued
+	 * while blocked cannot be kept. */
+	lineedit_flush(le);
+	if (le->out_used > 0) {
+		lineedit_output_drop(le, le->out_used);
+	}
+
+	le->out_buf = buf;
+	le->out_size = (buf != NULL) ? size : 0;
+	le->out_used = 0;
+
+	return LINEEDIT_SET_OUTPUT_BUFFER_OK;
+}
+
+
+int32_t lineedit_flush(struct lineedit *le) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_FLUSH_FAILED;
+	}
+
+	/* Messages printed above the line are followed by a single redraw.
+	 * The refresh flushes everything when finished. */
+	if (le->line_hidden && le->out_hold == 0) {
+		return (lineedit_refresh(le) == LINEEDIT_REFRESH_OK) ? LINEEDIT_FLUSH_OK : LINEEDIT_FLUSH_FAILED;
+	}
+
+	/* Queued output is sent by lineedit_output_resume if blocked. */
+	if (le->out_buf == NULL || le->out_used == 0 || le->out_blocked) {
+		return LINEEDIT_FLUSH_OK;
+	}
+
+	if (u_assert(le->print_handler != NULL)) {
+		return LINEEDIT_FLUSH_FAILED;
+	}
+
+	le->out_buf[le->out_used] = '\0';
+	uint32_t left = lineedit_output_send(le, le->out_buf, le->out_used);
+
+	/* Keep the unsent rest at the beginning of the buffer. */
+	memmove(le->out_buf, le->out_buf + le->out_used - left, left);
+	le->out_used = left;
+	if (le->out_saved > 0) {
+		le->out_saved--;
+	}
+
+	return LINEEDIT_FLUSH_OK;
+}
+
+
+int32_t lineedit_output_pending(struct lineedit *le, uint32_t *pending) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_OUTPUT_PENDING_FAILED;
+	}
+
+	if (pending != NULL) {
+		*pending = le->out_blocked ? le->out_used : 0;
+	}
+
+	return le->out_blocked ? LINEEDIT_OUTPUT_PENDING_BLOCKED : LINEEDIT_OUTPUT_PENDING_OK;
+}
+
+
+int32_t lineedit_output_resume(struct lineedit *le) {
+	if (u_assert(le != NULL) ||
+	    u_assert(le->print_handler != NULL)) {
+		return LINEEDIT_OUTPUT_RESUME_FAILED;
+	}
+
+	if (!le->out_blocked) {
+		return LINEEDIT_OUTPUT_RESUME_OK;
+	}
+
+	/* Send the queue first. All redraws requested while the output was
+	 * blocked are collapsed into a single one, made only after the whole
+	 * queue is sent. */
+	le->out_blocked = 0;
+	lineedit_output_hold(le);
+	lineedit_flush(le);
+	if (!le->out_blocked && le->redraw_pending) {
+		le->redraw_pending = 0;
+		lineedit_update(le);
+	}
+	lineedit_output_release(le);
+
+	return le->out_blocked ? LINEEDIT_OUTPUT_RESUME_BLOCKED : LINEEDIT_OUTPUT_RESUME_OK;
+}
+
+
+int32_t lineedit_print_above(struct lineedit *le, const char *msg) {
+	if (u_assert(le != NULL) ||
+	    u_assert(msg != NULL) ||
+	    u_assert(le->print_handler != NULL)) {
+		return LINEEDIT_PRINT_ABOVE_FAILED;
+	}
+
+	/* The output is released without a flush, the line is redrawn and
+	 * the staged output is sent by the next flush only. */
+	lineedit_output_hold(le);
+
+	/* Erase all rows of the line once, the first message is printed on
+	 * the first of them. */
+	if (!le->line_hidden) {
+		lineedit_write(le, "\r", 1);
+		if (le->shadow_row > 0) {
+			lineedit_escape_print(le, ESC_CURSOR_UP, le->shadow_row);
+		}
+		if (le->multiline || le->shadow_row > 0) {
+			lineedit_escape_print(le, ESC_ERASE_SCREEN_END, 0);
+		} else {
+			lineedit_escape_print(le, ESC_ERASE_LINE_END, 0);
+		}
+		le->shadow_row = 0;
+		le->shadow_valid = 0;
+		le->line_hidden = 1;
+	}
+
+	int32_t ret = LINEEDIT_PRINT_OK;
+	const char *nl;
+	while (ret == LINEEDIT_PRINT_OK && (nl = strchr(msg, '\n')) != NULL) {
+		ret = lineedit_write(le, msg, nl - msg);
+		if (ret == LINEEDIT_PRINT_OK) {
+			ret = lineedit_write(le, "\r\n", 2);
+		}
+		msg = nl + 1;
+	}
+	if (ret == LINEEDIT_PRINT_OK && *msg != '\0') {
+		ret = lineedit_write(le, msg, strlen(msg));
+		if (ret == LINEEDIT_PRINT_OK) {
+			ret = lineedit_write(le, "\r\n", 2);
+		}
+	}
+	lineedit_output_unhold(le);
+
+	return (ret == LINEEDIT_PRINT_OK) ? LINEEDIT_PRINT_ABOVE_OK : LINEEDIT_PRINT_ABOVE_FAILED;
+}
+
+
+int32_t lineedit_get_saved_calls(struct lineedit *le, uint32_t *saved) {
+	if (u_assert(le != NULL) ||
+	    u_assert(saved != NULL)) {
+		return LINEEDIT_GET_SAVED_CALLS_FAILED;
+	}
+
+	*saved = le->out_saved;
+
+	return LINEEDIT_GET_SAVED_CALLS_OK;
 }
 
 
@@ -50,13 +745,33 @@ int32_t lineedit_escape_print(struct lineedit *le, enum lineedit_escape_seq esc,
 		return LINEEDIT_ESCAPE_PRINT_FAILED;
 	}
 
+	LINEEDIT_STAT_ADD(le, escapes, 1);
+
 	char s[20];
 	switch (esc) {
 		case ESC_CURSOR_LEFT:
-			lineedit_print(le, "\x1b[D");
+			if (param > 1) {
+				snprintf(s, sizeof(s), "\x1b[%dD", param);
+				lineedit_print(le, s);
+			} else {
+				lineedit_print(le, "\x1b[D");
+			}
 			break;
 		case ESC_CURSOR_RIGHT:
-			lineedit_print(le, "\x1b[C");
+			if (param > 1) {
+				snprintf(s, sizeof(s), "\x1b[%dC", param);
+				lineedit_print(le, s);
+			} else {
+				lineedit_print(le, "\x1b[C");
+			}
+			break;
+		case ESC_CURSOR_COLUMN:
+			if (param > 1) {
+				snprintf(s, sizeof(s), "\x1b[%dG", param);
+				lineedit_print(le, s);
+			} else {
+				lineedit_print(le, "\x1b[G");
+			}
 			break;
 		case ESC_COLOR:
 			snprintf(s, sizeof(s), "\x1b[%dm", param);
@@ -77,6 +792,28 @@ int32_t lineedit_escape_print(struct lineedit *le, enum lineedit_escape_seq esc,
 		case ESC_ERASE_LINE_END:
 			lineedit_print(le, "\x1b[K");
 			break;
+		case ESC_BRACKETED_PASTE:
+			lineedit_print(le, param ? "\x1b[?2004h" : "\x1b[?2004l");
+			break;
+		case ESC_CURSOR_UP:
+			if (param > 1) {
+				snprintf(s, sizeof(s), "\x1b[%dA", param);
+				lineedit_print(le, s);
+			} else {
+				lineedit_print(le, "\x1b[A");
+			}
+			break;
+		case ESC_CURSOR_DOWN:
+			if (param > 1) {
+				snprintf(s, sizeof(s), "\x1b[%dB", param);
+				lineedit_print(le, s);
+			} else {
+				lineedit_print(le, "\x1b[B");
+			}
+			break;
+		case ESC_ERASE_SCREEN_END:
+			lineedit_print(le, "\x1b[J");
+			break;
 		default:
 			return LINEEDIT_ESCAPE_PRINT_FAILED;
 	}
@@ -85,397 +822,3265 @@ int32_t lineedit_escape_print(struct lineedit *le, enum lineedit_escape_seq esc,
 }
 
 
-int32_t lineedit_init(struct lineedit *le, uint32_t line_len) {
-	if (u_assert(le != NULL) ||
-	    u_assert(line_len > 0)) {
-		return LINEEDIT_INIT_FAILED;
+/* Record header/trailer access. Records may be placed at any offset, use
+ * memcpy to be safe on platforms without unaligned access. An attached
+ * arena (eg. mapped from a file) may be damaged, lengths and offsets are
+ * never followed out of the buffer. Garbage may be read then, but the
+ * walks are bounded by the number of records. */
+#define LINEEDIT_RING_DELETED 0x8000
+#define LINEEDIT_RING_MAX_PAYLOAD 0x7fff
+#define LINEEDIT_RING_OVERHEAD 4
+
+static uint16_t lineedit_ring_get16(const struct lineedit_ring *r, uint32_t off) {
+	uint16_t v = 0;
+	if (r->size >= 2 && off <= (r->size - 2)) {
+		memcpy(&v, r->buf + off, sizeof(v));
 	}
+	return v;
+}
 
-	/* Zero the whole structure. */
-	memset(le, 0, sizeof(struct lineedit));
-	le->len = line_len;
-	le->history_size = LINEEDIT_HISTORY_LEN;
-	le->escape = ESC_NONE;
-	le->recall_index = -1;
 
-	/* Allocate line editing buffer and its corresponding history buffers.
-	 * If one of the allocation fails, free any allocated resources and return
-	 * with error. */
-	le->text = calloc(1, le->len);
-	le->history = calloc(1, le->len * le->history_size);
-	if (le->text == NULL || le->history == NULL) {
-		lineedit_free(le);
+static void lineedit_ring_set16(struct lineedit_ring *r, uint32_t off, uint16_t v) {
+	if (r->size >= 2 && off <= (r->size - 2)) {
+		memcpy(r->buf + off, &v, sizeof(v));
+	}
+}
+
+
+static void lineedit_ring_init(struct lineedit_ring *r, uint8_t *buf, uint32_t size) {
+	r->buf = buf;
+	r->size = size;
+	r->tail = 0;
+	r->head = 0;
+	r->wrap = 0;
+	r->count = 0;
+}
+
+
+static uint32_t lineedit_ring_len(const struct lineedit_ring *r, uint32_t off) {
+	if (r->size < LINEEDIT_RING_OVERHEAD || off > (r->size - LINEEDIT_RING_OVERHEAD)) {
+		return 0;
+	}
+	uint32_t len = lineedit_ring_get16(r, off) & LINEEDIT_RING_MAX_PAYLOAD;
+	if (len > (r->size - LINEEDIT_RING_OVERHEAD - off)) {
+		len = r->size - LINEEDIT_RING_OVERHEAD - off;
+	}
+	return len;
+}
+
+
+static uint8_t *lineedit_ring_payload(const struct lineedit_ring *r, uint32_t off) {
+	return r->buf + off + 2;
+}
+
+
+static uint32_t lineedit_ring_deleted(const struct lineedit_ring *r, uint32_t off) {
+	return lineedit_ring_get16(r, off) & LINEEDIT_RING_DELETED;
+}
+
+
+static void lineedit_ring_delete(struct lineedit_ring *r, uint32_t off) {
+	lineedit_ring_set16(r, off, lineedit_ring_get16(r, off) | LINEEDIT_RING_DELETED);
+}
+
+
+/* Data are wrapped if the newer records continue from the beginning of the
+ * buffer (they are placed below the oldest one). */
+static uint32_t lineedit_ring_wrapped(const struct lineedit_ring *r) {
+	return r->count > 0 && r->head <= r->tail;
+}
+
+
+/* Offset of the record ending at @a end. */
+static uint32_t lineedit_ring_ending(const struct lineedit_ring *r, uint32_t end) {
+	uint32_t len = lineedit_ring_get16(r, end - 2);
+	if ((len + LINEEDIT_RING_OVERHEAD) > end) {
+		return 0;
+	}
+	return end - len - LINEEDIT_RING_OVERHEAD;
+}
+
+
+/* Offset of the newest record. The ring must not be empty. */
+static uint32_t lineedit_ring_newest(const struct lineedit_ring *r) {
+	return lineedit_ring_ending(r, r->head);
+}
+
+
+/* Offset of the record older than the one at @a off. The record at @a off
+ * must not be the oldest one. */
+static uint32_t lineedit_ring_older(const struct lineedit_ring *r, uint32_t off) {
+	return lineedit_ring_ending(r, (off == 0) ? r->wrap : off);
+}
+
+
+/* Offset of the record newer than the one at @a off (the head if it is
+ * the newest one). */
+static uint32_t lineedit_ring_newer(const struct lineedit_ring *r, uint32_t off) {
+	off += lineedit_ring_len(r, off) + LINEEDIT_RING_OVERHEAD;
+	if (lineedit_ring_wrapped(r) && off == r->wrap) {
+		return 0;
+	}
+	return off;
+}
+
+
+/* Drop the oldest record. Returns 1 if it was not deleted before. */
+static uint32_t lineedit_ring_drop(struct lineedit_ring *r) {
+	uint32_t live = !lineedit_ring_deleted(r, r->tail);
+	uint32_t wrapped = lineedit_ring_wrapped(r);
+
+	r->tail += lineedit_ring_len(r, r->tail) + LINEEDIT_RING_OVERHEAD;
+	r->count--;
+	if (r->count == 0) {
+		r->tail = 0;
+		r->head = 0;
+	} else if (wrapped && r->tail >= r->wrap) {
+		r->tail = 0;
+	} else if (r->tail > r->size) {
+		r->tail = r->size;
+	}
+
+	return live;
+}
+
+
+/* Allocate a new record with @a len bytes of payload after the newest one,
+ * dropping the oldest records as needed. The number of dropped records which
+ * were not deleted is added to @a dropped. Returns offset of the new record
+ * or -1 if it cannot fit. */
+static int32_t lineedit_ring_alloc(struct lineedit_ring *r, uint32_t len, uint32_t *dropped) {
+	uint32_t total = len + LINEEDIT_RING_OVERHEAD;
+	if (len > LINEEDIT_RING_MAX_PAYLOAD || total > r->size) {
+		return -1;
+	}
+
+	while (1) {
+		if (!lineedit_ring_wrapped(r)) {
+			/* Free space is above the head, continue from the beginning
+			 * if the record doesn't fit. */
+			if ((r->head + total) <= r->size) {
+				break;
+			}
+			r->wrap = r->head;
+			r->head = 0;
+			if (r->count == 0) {
+				break;
+			}
+			continue;
+		}
+		/* Free space is between the head and the oldest record. */
+		if ((r->head + total) <= r->tail) {
+			break;
+		}
+		*dropped += lineedit_ring_drop(r);
+	}
+
+	uint32_t off = r->head;
+	lineedit_ring_set16(r, off, len);
+	lineedit_ring_set16(r, off + 2 + len, len);
+	r->head += total;
+	r->count++;
+
+	return off;
+}
+
+
+/* Make the newest record at @a off @a n bytes longer if there is free space
+ * after it. Returns zero if it cannot be done. */
+static uint32_t lineedit_ring_extend(struct lineedit_ring *r, uint32_t off, uint32_t n) {
+	uint32_t len = lineedit_ring_len(r, off) + n;
+	uint32_t limit = lineedit_ring_wrapped(r) ? r->tail : r->size;
+	if ((off + len - n + LINEEDIT_RING_OVERHEAD) != r->head ||
+	    len > LINEEDIT_RING_MAX_PAYLOAD || (r->head + n) > limit) {
+		return 0;
+	}
+
+	lineedit_ring_set16(r, off, len);
+	lineedit_ring_set16(r, off + 2 + len, len);
+	r->head += n;
+
+	return 1;
+}
+
+
+/* Undo log record payload: type, 16 bit position and the inserted or
+ * deleted text. Records of an undo step following the first one are marked
+ * by LINEEDIT_UNDO_JOIN. */
+#define LINEEDIT_UNDO_INSERT 1
+#define LINEEDIT_UNDO_DELETE 2
+#define LINEEDIT_UNDO_JOIN 4
+#define LINEEDIT_UNDO_HEADER 3
+
+/* The next edit may extend the newest record (single characters typed or
+ * deleted), replace it (the line replaced again) or join its step (text
+ * pasted at once). */
+#define LINEEDIT_UNDO_MERGE_CHAR 1
+#define LINEEDIT_UNDO_MERGE_LINE 2
+#define LINEEDIT_UNDO_MERGE_PASTE 3
+
+static uint32_t lineedit_undo_type(const struct lineedit_ring *r, uint32_t off) {
+	return lineedit_ring_payload(r, off)[0];
+}
+
+
+static uint32_t lineedit_undo_pos(const struct lineedit_ring *r, uint32_t off) {
+	uint16_t pos;
+	memcpy(&pos, lineedit_ring_payload(r, off) + 1, sizeof(pos));
+	return pos;
+}
+
+
+static char *lineedit_undo_text(const struct lineedit_ring *r, uint32_t off) {
+	return (char *)lineedit_ring_payload(r, off) + LINEEDIT_UNDO_HEADER;
+}
+
+
+static uint32_t lineedit_undo_len(const struct lineedit_ring *r, uint32_t off) {
+	return lineedit_ring_len(r, off) - LINEEDIT_UNDO_HEADER;
+}
+
+
+static void lineedit_undo_reset(struct lineedit *le) {
+	lineedit_ring_init(&le->undo, le->undo.buf, le->undo.size);
+	le->undo_pos = 0;
+	le->undo_done = 0;
+	le->undo_merge = 0;
+}
+
+
+/* Copy @a n bytes of text to @a dst, from @a s or from position @a pos of
+ * the line if @a s is NULL. */
+static void lineedit_undo_copy(struct lineedit *le, char *dst, uint32_t pos, const char *s, uint32_t n) {
+	if (s != NULL) {
+		memcpy(dst, s, n);
+		return;
+	}
+	for (uint32_t i = 0; i < n;) {
+		const char *t;
+		uint32_t m = lineedit_text_span(le, pos + i, pos + n, &t);
+		memcpy(dst + i, t, m);
+		i += m;
+	}
+}
+
+
+/* Log an edit of the line, @a n bytes inserted at or deleted from position
+ * @a pos. Deleted text is copied from the line, it must be logged before it
+ * is removed. Undone records are forgotten. If @a single is set, the edit
+ * is a single character and it is merged with the newest record if it
+ * continues it. */
+static void lineedit_undo_log(struct lineedit *le, uint32_t type, uint32_t pos, const char *s, uint32_t n, uint32_t single) {
+	struct lineedit_ring *r = &le->undo;
+	if (r->buf == NULL || n == 0) {
+		return;
+	}
+
+	r->count = le->undo_done;
+	r->head = le->undo_pos;
+	if (r->count == 0) {
+		if (le->paste && le->undo_merge == LINEEDIT_UNDO_MERGE_PASTE) {
+			/* Beginning of the pasted text did not fit. */
+			return;
+		}
+		lineedit_undo_reset(le);
+	}
+
+	/* Records of a pasted text are merged or joined together. */
+	uint32_t pasted = le->paste && le->undo_merge == LINEEDIT_UNDO_MERGE_PASTE && r->count > 0;
+	uint32_t merge = pasted || (single && le->undo_merge == LINEEDIT_UNDO_MERGE_CHAR && r->count > 0);
+	if (pasted) {
+		type |= LINEEDIT_UNDO_JOIN;
+	}
+	le->undo_merge = single ? LINEEDIT_UNDO_MERGE_CHAR : 0;
+	if (le->paste) {
+		le->undo_merge = LINEEDIT_UNDO_MERGE_PASTE;
+	}
+	if (merge) {
+		uint32_t off = lineedit_ring_older(r, r->head);
+		uint32_t t = lineedit_undo_type(r, off) & ~LINEEDIT_UNDO_JOIN;
+		uint32_t kind = type & ~LINEEDIT_UNDO_JOIN;
+		uint32_t p = lineedit_undo_pos(r, off);
+		uint32_t len = lineedit_undo_len(r, off);
+		char *text = lineedit_undo_text(r, off);
+
+		if (t == kind && kind == LINEEDIT_UNDO_INSERT && (p + len) == pos && lineedit_ring_extend(r, off, n)) {
+			/* Typed after the inserted text. */
+			lineedit_undo_copy(le, text + len, pos, s, n);
+			le->undo_pos = r->head;
+			return;
+		}
+		if (t == kind && kind == LINEEDIT_UNDO_DELETE && pos == p && lineedit_ring_extend(r, off, n)) {
+			/* Deleted after the deleted text. */
+			lineedit_undo_copy(le, text + len, pos, s, n);
+			le->undo_pos = r->head;
+			return;
+		}
+		if (t == kind && kind == LINEEDIT_UNDO_DELETE && (pos + n) == p && lineedit_ring_extend(r, off, n)) {
+			/* Deleted before the deleted text. */
+			memmove(text + n, text, len);
+			lineedit_undo_copy(le, text, pos, s, n);
+			uint16_t pos16 = pos;
+			memcpy(lineedit_ring_payload(r, off) + 1, &pos16, sizeof(pos16));
+			le->undo_pos = r->head;
+			return;
+		}
+	}
+
+	uint32_t dropped = 0;
+	int32_t off = lineedit_ring_alloc(r, LINEEDIT_UNDO_HEADER + n, &dropped);
+	if (off < 0) {
+		/* Older records cannot be applied without this one. */
+		uint32_t merge = le->undo_merge;
+		lineedit_undo_reset(le);
+		le->undo_merge = merge;
+		return;
+	}
+	uint8_t *payload = lineedit_ring_payload(r, off);
+	uint16_t pos16 = pos;
+	payload[0] = type;
+	memcpy(payload + 1, &pos16, sizeof(pos16));
+	lineedit_undo_copy(le, (char *)payload + LINEEDIT_UNDO_HEADER, pos, s, n);
+
+	/* Steps are never undone partially, drop the rest of the oldest one. */
+	while (r->count > 0 && (lineedit_undo_type(r, r->tail) & LINEEDIT_UNDO_JOIN)) {
+		lineedit_ring_drop(r);
+	}
+	le->undo_done = r->count;
+	le->undo_pos = r->head;
+}
+
+
+/* Insert @a n bytes of text taking @a w columns at cursor position. */
+static void lineedit_text_insert(struct lineedit *le, const char *s, uint32_t n, uint32_t w) {
+	lineedit_gap_move(le, le->cursor);
+	memcpy(le->text + le->gap_start, s, n);
+	le->gap_start += n;
+	le->text_len += n;
+	le->cursor += n;
+	le->text_cols += w;
+	le->cursor_col += w;
+}
+
+
+/* Apply the undo log record at @a off, revert it if @a undo is set. The
+ * cursor is left after an inserted text or at the place of a deleted one.
+ * Returns zero if the record does not match the line. */
+static uint32_t lineedit_undo_apply(struct lineedit *le, uint32_t off, uint32_t undo) {
+	struct lineedit_ring *r = &le->undo;
+	uint32_t insert = (lineedit_undo_type(r, off) & ~LINEEDIT_UNDO_JOIN) == LINEEDIT_UNDO_INSERT;
+	uint32_t pos = lineedit_undo_pos(r, off);
+	uint32_t n = lineedit_undo_len(r, off);
+	const char *text = lineedit_undo_text(r, off);
+
+	if (insert != undo) {
+		if (pos > le->text_len || (le->text_len + n) > (le->len - 1)) {
+			return 0;
+		}
+		lineedit_cursor_move(le, pos);
+		lineedit_text_insert(le, text, n, lineedit_width(text, n));
+	} else {
+		if ((pos + n) > le->text_len) {
+			return 0;
+		}
+		lineedit_cursor_move(le, pos);
+		lineedit_remove(le, pos, pos + n);
+	}
+
+	return 1;
+}
+
+
+/* Insert @a n bytes of text at cursor position and update the rest of the
+ * line once. Set @a ascii if the text is known to be plain ASCII, its width
+ * is not computed then. Characters not fitting into the line buffer are
+ * dropped. */
+static int32_t lineedit_insert_run(struct lineedit *le, const char *s, uint32_t n, uint32_t ascii) {
+	/* check if we have enough space, one byte is reserved for terminator */
+	if ((le->text_len + n) > (le->len - 1)) {
+		n = le->len - 1 - le->text_len;
+		while (n > 0 && LINEEDIT_UTF8_CONT(s[n])) {
+			n--;
+		}
+	}
+	if (n == 0) {
+		return LINEEDIT_INSERT_CHAR_FAILED;
+	}
+	uint32_t w = ascii ? n : lineedit_width(s, n);
+
+	uint32_t cp;
+	lineedit_undo_log(le, LINEEDIT_UNDO_INSERT, le->cursor, s, n, n == 1 || lineedit_utf8_decode(s, n, &cp) == n);
+
+	/* copy the run into the gap at cursor position */
+	lineedit_text_insert(le, s, n, w);
+
+	/* Pasted text is shown when the paste ends. */
+	if (!le->paste) {
+		lineedit_update(le);
+	}
+
+	return LINEEDIT_INSERT_CHAR_OK;
+}
+
+/* Shared history slot layout: 32 bit stamp, 16 bit length of the line and
+ * the line including its terminator. */
+static uint8_t *lineedit_shared_slot(struct lineedit_shared_history *sh, uint32_t seq) {
+	return sh->slots + (seq & (sh->slot_count - 1)) * sh->slot_size;
+}
+
+
+/* Slot contents may be read while they are written, copy them using
+ * relaxed atomic accesses to avoid a data race. The ordering is given by
+ * the stamp. */
+static void lineedit_shared_store(uint8_t *dst, const uint8_t *src, uint32_t n) {
+	for (uint32_t i = 0; i < n; i++) {
+		__atomic_store_n(&dst[i], src[i], __ATOMIC_RELAXED);
+	}
+}
+
+
+static void lineedit_shared_load(uint8_t *dst, const uint8_t *src, uint32_t n) {
+	for (uint32_t i = 0; i < n; i++) {
+		dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+	}
+}
+
+
+/* Save entry @a seq to its slot. The entry is dropped if a newer one
+ * already took the slot or if a writer a lap behind is still writing it
+ * (the whole ring was appended during its write), writers never wait. */
+static void lineedit_shared_write(struct lineedit_shared_history *sh, uint32_t seq, const char *line, uint32_t len) {
+	uint8_t *slot = lineedit_shared_slot(sh, seq);
+	uint32_t *stamp = (uint32_t *)slot;
+	uint32_t writing = seq * 2 + 1;
+
+	uint32_t cur = __atomic_load_n(stamp, __ATOMIC_RELAXED);
+	do {
+		if ((cur & 1) || (int32_t)(cur - writing) > 0) {
+			return;
+		}
+	} while (!__atomic_compare_exchange_n(stamp, &cur, writing, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	/* The odd stamp must be visible before the contents change. */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	uint16_t len16 = len;
+	__atomic_store_n((uint16_t *)(slot + 4), len16, __ATOMIC_RELAXED);
+	lineedit_shared_store(slot + 6, (const uint8_t *)line, len);
+	__atomic_store_n(&slot[6 + len], 0, __ATOMIC_RELAXED);
+	__atomic_store_n(stamp, seq * 2 + 2, __ATOMIC_RELEASE);
+}
+
+
+/* Copy entry @a seq to @a buf of @a size bytes (truncating it if needed).
+ * Returns -1 if the entry is not complete or it was overwritten. The copy
+ * may be torn if a writer changes the slot meanwhile, it is discarded then
+ * as usual for sequence locks. */
+static int32_t lineedit_shared_read(struct lineedit_shared_history *sh, uint32_t seq, char *buf, uint32_t size) {
+	uint8_t *slot = lineedit_shared_slot(sh, seq);
+	uint32_t *stamp = (uint32_t *)slot;
+	uint32_t done = seq * 2 + 2;
+
+	if (__atomic_load_n(stamp, __ATOMIC_ACQUIRE) != done) {
+		return -1;
+	}
+
+	uint16_t len = __atomic_load_n((uint16_t *)(slot + 4), __ATOMIC_RELAXED);
+	if (len > (sh->line_len - 1)) {
+		len = sh->line_len - 1;
+	}
+	if (len > (size - 1)) {
+		len = size - 1;
+	}
+	lineedit_shared_load((uint8_t *)buf, slot + 6, len);
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(stamp, __ATOMIC_RELAXED) != done) {
+		return -1;
+	}
+	buf[len] = '\0';
+
+	return 0;
+}
+
+
+/* Start browsing the shared history from its newest entry. */
+static void lineedit_shared_sync(struct lineedit *le) {
+	struct lineedit_shared_history *sh = le->shared_history;
+
+	le->shared_anchor = __atomic_load_n(&sh->head, __ATOMIC_ACQUIRE);
+	le->history_count = (le->shared_anchor < sh->slot_count) ? le->shared_anchor : sh->slot_count;
+}
+
+
+/* Append a line of @a line_len characters to the shared history. The
+ * arena holds a copy of the saved line. */
+static int32_t lineedit_shared_append(struct lineedit *le, const char *line, uint32_t line_len) {
+	struct lineedit_shared_history *sh = le->shared_history;
+	char *entry = (char *)le->history.buf;
+
+	if (line_len > (sh->line_len - 1)) {
+		line_len = sh->line_len - 1;
+	}
+
+	/* The newest entry may be replaced by other writers meanwhile, it
+	 * is only an optimization. */
+	if (le->history_flags & LINEEDIT_HISTORY_IGNORE_DUPS) {
+		uint32_t head = __atomic_load_n(&sh->head, __ATOMIC_ACQUIRE);
+		if (head > 0 &&
+		    lineedit_shared_read(sh, head - 1, entry, le->len) == 0 &&
+		    strlen(entry) == line_len &&
+		    !memcmp(entry, line, line_len)) {
+			return LINEEDIT_HISTORY_APPEND_OK;
+		}
+	}
+
+	uint32_t seq = __atomic_fetch_add(&sh->head, 1, __ATOMIC_RELAXED);
+	lineedit_shared_write(sh, seq, line, line_len);
+	LINEEDIT_STAT_ADD(le, history_appends, 1);
+
+	if (le->history_callback != NULL) {
+		memcpy(entry, line, line_len);
+		entry[line_len] = '\0';
+		le->history_callback(le, entry, le->history_callback_ctx);
+	}
+
+	return LINEEDIT_HISTORY_APPEND_OK;
+}
+
+
+int32_t lineedit_init(struct lineedit *le, uint32_t line_len) {
+	if (u_assert(le != NULL) ||
+	    u_assert(line_len > 0) ||
+	    u_assert(line_len <= LINEEDIT_RING_MAX_PAYLOAD)) {
+		return LINEEDIT_INIT_FAILED;
+	}
+
+	/* All buffers are allocated at once. */
+	uint32_t size = LINEEDIT_STORAGE_SIZE(line_len, LINEEDIT_HISTORY_SIZE);
+	uint8_t *storage = calloc(1, size);
+	if (storage == NULL) {
 		return LINEEDIT_INIT_FAILED;
 	}
 
-	/* History is saved in an array of strings le->len long. Initialize the
-	 * history by writing 0 at first position of every history entry. */
-	for (uint32_t i = 0; i < le->history_size; i++) {
-		le->history[i * le->len] = '\0';
+	if (lineedit_init_static(le, line_len, storage, size) != LINEEDIT_INIT_STATIC_OK) {
+		free(storage);
+		return LINEEDIT_INIT_FAILED;
 	}
+	le->storage_allocated = 1;
 
 	return LINEEDIT_INIT_OK;
 }
 
 
+int32_t lineedit_init_static(struct lineedit *le, uint32_t line_len, uint8_t *storage, uint32_t size) {
+	/* The history arena must be able to hold at least one full line. */
+	if (u_assert(le != NULL) ||
+	    u_assert(storage != NULL) ||
+	    u_assert(line_len > 0) ||
+	    u_assert(line_len <= LINEEDIT_RING_MAX_PAYLOAD) ||
+	    u_assert(size >= (3 * line_len + LINEEDIT_RING_OVERHEAD))) {
+		return LINEEDIT_INIT_STATIC_FAILED;
+	}
+
+	/* Zero the whole structure. */
+	memset(le, 0, sizeof(struct lineedit));
+	le->len = line_len;
+	le->escape = ESC_NONE;
+	le->recall_index = -1;
+	le->history_flags = LINEEDIT_HISTORY_IGNORE_DUPS;
+	le->paste_mode = 1;
+	le->paste_newline = LINEEDIT_PASTE_NEWLINE_SPACE;
+	le->cont_prompt = "";
+	le->history_cache_index = -1;
+	le->utf8 = 1;
+
+	/* Line buffer, its shadow copy and the history arena follow each
+	 * other in the storage. */
+	le->text = (char *)storage;
+	le->gap_end = le->len;
+	le->shadow = (char *)storage + line_len;
+	lineedit_ring_init(&le->history, storage + 2 * line_len, size - 2 * line_len);
+
+	return LINEEDIT_INIT_STATIC_OK;
+}
+
+
 int32_t lineedit_free(struct lineedit *le) {
 	if (u_assert(le != NULL) ||
 	    u_assert(le->text != NULL)) {
 		return LINEEDIT_FREE_FAILED;
 	}
 
-	free(le->history);
-	free(le->text);
+	/* The line buffer is at the beginning of the storage. */
+	if (le->storage_allocated) {
+		free(le->text);
+	}
+	le->text = NULL;
 
 	return LINEEDIT_FREE_OK;
 }
 
 
-int32_t lineedit_history_append(struct lineedit *le, const char *line) {
-	if (u_assert(le != NULL) ||
-	    u_assert(line != NULL)) {
-		return LINEEDIT_HISTORY_APPEND_FAILED;
+/* Length of the history entry at @a off without the terminator. */
+static uint32_t lineedit_history_len(const struct lineedit_ring *r, uint32_t off) {
+	uint32_t len = lineedit_ring_len(r, off);
+	return (len > 0) ? (len - 1) : 0;
+}
+
+
+/* Autosuggestion index. Entries are identified by sequence numbers counted
+ * by the arena allocations, the offset of an entry doesn't change while it
+ * is present. Prefixes are hashed using FNV-1a. */
+#define LINEEDIT_HINT_HASH_BASIS 2166136261u
+#define LINEEDIT_HINT_HASH_PRIME 16777619u
+
+static uint32_t *lineedit_hint_bucket(struct lineedit *le, uint32_t hash) {
+	return le->hint_index + 2 * (hash % le->hint_buckets);
+}
+
+
+/* Prefixes of the indexed depth have their own buckets holding heads of
+ * chains of entries starting with them. */
+static uint32_t *lineedit_hint_chain(struct lineedit *le, uint32_t hash) {
+	return le->hint_index + 2 * le->hint_buckets + 2 * (hash % le->hint_buckets);
+}
+
+
+/* Link of entry @a seq to the previous entry of its chain. The link of an
+ * entry is valid while no entry @a hint_buckets newer was allocated. */
+static uint32_t *lineedit_hint_link(struct lineedit *le, uint32_t seq) {
+	return le->hint_index + 4 * le->hint_buckets + 2 * (seq % le->hint_buckets);
+}
+
+
+/* Check if entry @a seq is still present in the arena. */
+static uint32_t lineedit_hint_present(struct lineedit *le, uint32_t seq) {
+	return (le->history_seq - seq - 1) < le->history.count;
+}
+
+
+/* Sequence number of an entry which is not present (evicted long ago). */
+static uint32_t lineedit_hint_none(struct lineedit *le) {
+	return le->history_seq - le->history.count - 1;
+}
+
+
+/* Save entry @a seq at @a off to the buckets of all its indexed prefixes
+ * shorter than the entry (it doesn't extend a line equal to it). Entries
+ * longer than the indexed depth are added to the chain of the deepest
+ * prefix. */
+static void lineedit_hint_add(struct lineedit *le, uint32_t seq, uint32_t off) {
+	const uint8_t *entry = lineedit_ring_payload(&le->history, off);
+	uint32_t len = lineedit_history_len(&le->history, off);
+	uint32_t hash = LINEEDIT_HINT_HASH_BASIS;
+
+	for (uint32_t i = 0; (i + 1) < len && i < LINEEDIT_HINT_DEPTH; i++) {
+		hash = (hash ^ entry[i]) * LINEEDIT_HINT_HASH_PRIME;
+		uint32_t *bucket = lineedit_hint_bucket(le, hash);
+		if ((i + 1) == LINEEDIT_HINT_DEPTH) {
+			bucket = lineedit_hint_chain(le, hash);
+			uint32_t *link = lineedit_hint_link(le, seq);
+			link[0] = bucket[0];
+			link[1] = bucket[1];
+		}
+		bucket[0] = seq;
+		bucket[1] = off;
 	}
+}
+
 
-	/* Shift all history entries first. The newest one has index 0. */
-	for (uint32_t i = le->history_size - 1; i > 0 ; i--) {
-		strlcpy(le->history + (i * le->len), le->history + ((i - 1) * le->len), le->len);
+/* Index all entries in the arena again and forget the displayed one. */
+static void lineedit_hint_rebuild(struct lineedit *le) {
+	struct lineedit_ring *r = &le->history;
+
+	le->hint_seq = lineedit_hint_none(le);
+	if (le->hint_index == NULL) {
+		return;
+	}
+	for (uint32_t i = 0; i < (3 * le->hint_buckets); i++) {
+		le->hint_index[2 * i] = lineedit_hint_none(le);
+		le->hint_index[2 * i + 1] = 0;
 	}
-	strlcpy(le->history, line, le->len);
 
-	return LINEEDIT_HISTORY_APPEND_OK;
+	/* Walk from the oldest entry, newer ones replace it in the buckets. */
+	uint32_t off = r->tail;
+	uint32_t seq = le->history_seq - r->count;
+	for (uint32_t i = 0; i < r->count; i++) {
+		if (i > 0) {
+			off = lineedit_ring_newer(r, off);
+		}
+		if (!lineedit_ring_deleted(r, off)) {
+			lineedit_hint_add(le, seq + i, off);
+		}
+	}
 }
 
 
-int32_t lineedit_history_recall(struct lineedit *le, char **line, int32_t recall_index) {
-	if (u_assert(le != NULL) ||
-	    u_assert(line != NULL)) {
-		return LINEEDIT_HISTORY_RECALL_FAILED;
+/* Check if the entry at @a off starts with the first @a n bytes of the
+ * line. The entry must be at least @a n bytes long. The gap is left where
+ * it is, both parts of the line are compared. */
+static uint32_t lineedit_hint_prefix(struct lineedit *le, uint32_t off, uint32_t n) {
+	const char *entry = (const char *)lineedit_ring_payload(&le->history, off);
+	for (uint32_t i = 0; i < n;) {
+		const char *t;
+		uint32_t m = lineedit_text_span(le, i, n, &t);
+		if (memcmp(entry + i, t, m)) {
+			return 0;
+		}
+		i += m;
+	}
+	return 1;
+}
+
+
+/* Check if the entry at @a off is longer than the first @a n bytes of the
+ * line and starts with them. */
+static uint32_t lineedit_hint_match(struct lineedit *le, uint32_t off, uint32_t n) {
+	struct lineedit_ring *r = &le->history;
+	return !lineedit_ring_deleted(r, off) &&
+	       lineedit_history_len(r, off) > n &&
+	       lineedit_hint_prefix(le, off, n);
+}
+
+
+/* Find the newest entry extending the line. Returns zero and its sequence
+ * number and offset in @a seq and @a off or -1 if there is none. */
+static int32_t lineedit_hint_find(struct lineedit *le, uint32_t *seq, uint32_t *off) {
+	struct lineedit_ring *r = &le->history;
+	uint32_t n = le->text_len;
+	if (n == 0 || r->count == 0) {
+		return -1;
+	}
+
+	/* The entry found for a shorter line is still the newest one if it
+	 * extends the line too. */
+	if (n >= le->hint_start && lineedit_hint_present(le, le->hint_seq) &&
+	    lineedit_hint_match(le, le->hint_off, n)) {
+		*seq = le->hint_seq;
+		*off = le->hint_off;
+		return 0;
+	}
+
+	uint32_t k = (n < LINEEDIT_HINT_DEPTH) ? n : LINEEDIT_HINT_DEPTH;
+	uint32_t hash = LINEEDIT_HINT_HASH_BASIS;
+	for (uint32_t i = 0; i < k; i++) {
+		hash = (hash ^ (uint8_t)lineedit_text_char(le, i)) * LINEEDIT_HINT_HASH_PRIME;
+	}
+
+	/* The bucket holds the newest entry longer than the first @a k bytes
+	 * and starting with them, unless it was taken by a colliding prefix
+	 * later. There is none if it is not present. */
+	uint32_t *bucket = (k == LINEEDIT_HINT_DEPTH) ? lineedit_hint_chain(le, hash) : lineedit_hint_bucket(le, hash);
+	uint32_t s = bucket[0];
+	uint32_t o = bucket[1];
+	if (!lineedit_hint_present(le, s)) {
+		return -1;
+	}
+
+	/* Lines of the indexed depth or longer are matched against the chain,
+	 * otherwise older entries are walked in the arena to get over
+	 * a collision. Both walks are bounded. */
+	uint32_t oldest = le->history_seq - r->count;
+	for (uint32_t i = 0; i < LINEEDIT_HINT_WALK; i++) {
+		if (lineedit_hint_match(le, o, n)) {
+			*seq = s;
+			*off = o;
+			return 0;
+		}
+		if (k == LINEEDIT_HINT_DEPTH) {
+			if ((le->history_seq - s) > le->hint_buckets) {
+				return -1;
+			}
+			uint32_t *link = lineedit_hint_link(le, s);
+			s = link[0];
+			o = link[1];
+			if (!lineedit_hint_present(le, s)) {
+				return -1;
+			}
+		} else {
+			if (s == oldest) {
+				return -1;
+			}
+			o = lineedit_ring_older(r, o);
+			s--;
+		}
+	}
+
+	return -1;
+}
+
+
+/* Length of the character at the beginning of the suggestion @a s (@a n
+ * bytes available) and its width in @a w. Returns 0 if it cannot be
+ * displayed. */
+static uint32_t lineedit_hint_char(struct lineedit *le, const char *s, uint32_t n, uint32_t *w) {
+	*w = 1;
+	if (s[0] >= 32 && s[0] <= 126) {
+		return 1;
+	}
+	if (!le->utf8) {
+		return 0;
+	}
+	uint32_t cp;
+	uint32_t len = lineedit_utf8_decode(s, n, &cp);
+	if (len == 1 || cp < 0xa0) {
+		return 0;
+	}
+	*w = lineedit_char_width(cp);
+	return len;
+}
+
+
+/* Insert the rest of the displayed suggestion. Returns zero if none is
+ * displayed or the cursor is not at the end of the line. */
+static uint32_t lineedit_hint_accept(struct lineedit *le) {
+	if (le->cursor != le->text_len || le->hint_cols == 0 ||
+	    le->hint_start != le->text_len || !lineedit_hint_present(le, le->hint_seq)) {
+		return 0;
+	}
+
+	struct lineedit_ring *r = &le->history;
+	const char *entry = (const char *)lineedit_ring_payload(r, le->hint_off);
+	uint32_t len = lineedit_history_len(r, le->hint_off);
+	le->undo_merge = 0;
+	lineedit_insert_run(le, entry + le->text_len, len - le->text_len, 0);
+
+	return 1;
+}
+
+
+/* Erase the displayed suggestion (when the line is entered). */
+static void lineedit_hint_clear(struct lineedit *le) {
+	if (le->hint_cols == 0 || !le->shadow_valid) {
+		return;
+	}
+	lineedit_output_hold(le);
+	if (le->shadow_cols > le->shadow_cursor_col) {
+		lineedit_escape_print(le, ESC_CURSOR_RIGHT, le->shadow_cols - le->shadow_cursor_col);
+	}
+	lineedit_escape_print(le, ESC_ERASE_LINE_END, 0);
+	le->shadow_cursor = le->shadow_len;
+	le->shadow_cursor_col = le->shadow_cols;
+	le->hint_cols = 0;
+	lineedit_output_release(le);
+}
+
+
+int32_t lineedit_history_append(struct lineedit *le, const char *line) {
+	if (u_assert(le != NULL) ||
+	    u_assert(line != NULL)) {
+		return LINEEDIT_HISTORY_APPEND_FAILED;
+	}
+
+	uint32_t line_len = strlen(line);
+	if (line_len > (le->len - 1)) {
+		line_len = le->len - 1;
+	}
+
+	/* Empty lines are not saved. */
+	if (line_len == 0) {
+		return LINEEDIT_HISTORY_APPEND_OK;
+	}
+
+	if (le->shared_history != NULL) {
+		return lineedit_shared_append(le, line, line_len);
+	}
+
+	struct lineedit_ring *r = &le->history;
+
+	/* The newest record is never a deleted one, compare with it. */
+	if ((le->history_flags & LINEEDIT_HISTORY_IGNORE_DUPS) && r->count > 0) {
+		uint32_t newest = lineedit_ring_newest(r);
+		if (lineedit_ring_len(r, newest) == (line_len + 1) &&
+		    !memcmp(lineedit_ring_payload(r, newest), line, line_len)) {
+			return LINEEDIT_HISTORY_APPEND_OK;
+		}
+	}
+
+	/* Mark all older equal entries as deleted. */
+	if ((le->history_flags & LINEEDIT_HISTORY_ERASE_DUPS) && r->count > 0) {
+		uint32_t off = lineedit_ring_newest(r);
+		for (uint32_t i = 0; i < r->count; i++) {
+			if (i > 0) {
+				off = lineedit_ring_older(r, off);
+			}
+			if (!lineedit_ring_deleted(r, off) &&
+			    lineedit_ring_len(r, off) == (line_len + 1) &&
+			    !memcmp(lineedit_ring_payload(r, off), line, line_len)) {
+				lineedit_ring_delete(r, off);
+				if (le->history_count > 0) {
+					le->history_count--;
+				}
+			}
+		}
+	}
+
+	uint32_t dropped = 0;
+	int32_t off = lineedit_ring_alloc(r, line_len + 1, &dropped);
+	if (off < 0) {
+		return LINEEDIT_HISTORY_APPEND_FAILED;
+	}
+	uint8_t *entry = lineedit_ring_payload(r, off);
+	memcpy(entry, line, line_len);
+	entry[line_len] = '\0';
+
+	/* Keep the count sane even if the arena is damaged. */
+	le->history_count = (dropped > le->history_count) ? 1 : (le->history_count + 1 - dropped);
+	if (le->hint_index != NULL) {
+		lineedit_hint_add(le, le->history_seq, off);
+	}
+	le->history_seq++;
+	le->hint_seq = lineedit_hint_none(le);
+	LINEEDIT_STAT_ADD(le, history_appends, 1);
+	LINEEDIT_STAT_ADD(le, history_evictions, dropped);
+	le->history_cache_index = -1;
+
+	if (le->history_callback != NULL) {
+		le->history_callback(le, (const char *)entry, le->history_callback_ctx);
+	}
+
+	return LINEEDIT_HISTORY_APPEND_OK;
+}
+
+
+int32_t lineedit_history_recall(struct lineedit *le, char **line, int32_t recall_index) {
+	if (u_assert(le != NULL) ||
+	    u_assert(line != NULL)) {
+		return LINEEDIT_HISTORY_RECALL_FAILED;
+	}
+
+	/* Entries appended to the shared history are seen when browsing
+	 * starts again. */
+	if (le->shared_history != NULL && le->recall_index == -1 && !le->search) {
+		lineedit_shared_sync(le);
+	}
+
+	if ((recall_index >= (int32_t)le->history_count) || (recall_index < -1)) {
+		return LINEEDIT_HISTORY_RECALL_FAILED;
+	}
+
+	if (recall_index == -1) {
+		*line = "";
+		return LINEEDIT_HISTORY_RECALL_OK;
+	}
+
+	/* Entries overwritten since browsing started cannot be recalled. */
+	if (le->shared_history != NULL) {
+		char *entry = (char *)le->history.buf;
+		if (lineedit_shared_read(le->shared_history, le->shared_anchor - 1 - recall_index, entry, le->len) < 0) {
+			return LINEEDIT_HISTORY_RECALL_FAILED;
+		}
+		*line = entry;
+		return LINEEDIT_HISTORY_RECALL_OK;
+	}
+
+	/* Walk from the newest entry or from the last recalled one if it is
+	 * closer (in either direction), skipping deleted entries. */
+	struct lineedit_ring *r = &le->history;
+	int32_t index = 0;
+	uint32_t off = lineedit_ring_newest(r);
+	if (le->history_cache_index >= 0) {
+		int32_t distance = le->history_cache_index - recall_index;
+		if (distance < 0) {
+			distance = -distance;
+		}
+		if (distance <= recall_index) {
+			index = le->history_cache_index;
+			off = le->history_cache_off;
+		}
+	}
+	/* Steps are bounded in case the arena is damaged. */
+	uint32_t steps = 0;
+	while (lineedit_ring_deleted(r, off) && steps++ < r->count) {
+		off = lineedit_ring_older(r, off);
+	}
+	while (index < recall_index && steps++ < (2 * r->count)) {
+		off = lineedit_ring_older(r, off);
+		if (!lineedit_ring_deleted(r, off)) {
+			index++;
+		}
+	}
+	while (index > recall_index && steps++ < (2 * r->count)) {
+		off = lineedit_ring_newer(r, off);
+		if (!lineedit_ring_deleted(r, off)) {
+			index--;
+		}
+	}
+
+	uint32_t len = lineedit_ring_len(r, off);
+	const uint8_t *entry = lineedit_ring_payload(r, off);
+	if (index != recall_index || len == 0 || entry[len - 1] != '\0') {
+		le->history_cache_index = -1;
+		return LINEEDIT_HISTORY_RECALL_FAILED;
+	}
+
+	le->history_cache_index = index;
+	le->history_cache_off = off;
+	*line = (char *)entry;
+
+	return LINEEDIT_HISTORY_RECALL_OK;
+}
+
+
+int32_t lineedit_set_history_flags(struct lineedit *le, uint32_t flags) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_SET_HISTORY_FLAGS_FAILED;
+	}
+
+	le->history_flags = flags;
+
+	return LINEEDIT_SET_HISTORY_FLAGS_OK;
+}
+
+
+int32_t lineedit_set_history_callback(struct lineedit *le, void (*callback)(struct lineedit *le, const char *line, void *ctx), void *ctx) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_SET_HISTORY_CALLBACK_FAILED;
+	}
+
+	le->history_callback = callback;
+	le->history_callback_ctx = ctx;
+
+	return LINEEDIT_SET_HISTORY_CALLBACK_OK;
+}
+
+
+int32_t lineedit_history_attach(struct lineedit *le, const struct lineedit_ring *ring, uint32_t count) {
+	if (u_assert(le != NULL) ||
+	    u_assert(ring != NULL) ||
+	    u_assert(ring->buf != NULL)) {
+		return LINEEDIT_HISTORY_ATTACH_FAILED;
+	}
+
+	/* Check only what can be checked without walking the records. */
+	if (ring->size < (le->len + LINEEDIT_RING_OVERHEAD) ||
+	    ring->tail > ring->size ||
+	    ring->head > ring->size ||
+	    ring->wrap > ring->size ||
+	    count > ring->count ||
+	    (ring->count > 0 && ring->head < LINEEDIT_RING_OVERHEAD)) {
+		return LINEEDIT_HISTORY_ATTACH_FAILED;
+	}
+
+	le->history = *ring;
+	le->history_count = count;
+	le->history_cache_index = -1;
+	le->recall_index = -1;
+	lineedit_hint_rebuild(le);
+
+	return LINEEDIT_HISTORY_ATTACH_OK;
+}
+
+
+int32_t lineedit_set_hint_index(struct lineedit *le, uint32_t *index, uint32_t buckets) {
+	if (u_assert(le != NULL) ||
+	    u_assert(index == NULL || buckets > 0)) {
+		return LINEEDIT_SET_HINT_INDEX_FAILED;
+	}
+
+	le->hint_index = index;
+	le->hint_buckets = buckets;
+	lineedit_hint_rebuild(le);
+
+	return LINEEDIT_SET_HINT_INDEX_OK;
+}
+
+
+int32_t lineedit_shared_history_init(struct lineedit_shared_history *sh, uint32_t line_len, uint8_t *storage, uint32_t size) {
+	if (u_assert(sh != NULL) ||
+	    u_assert(storage != NULL) ||
+	    u_assert(line_len > 0) ||
+	    u_assert(line_len <= LINEEDIT_RING_MAX_PAYLOAD)) {
+		return LINEEDIT_SHARED_HISTORY_INIT_FAILED;
+	}
+
+	/* Slot stamps are accessed atomically, align them. */
+	uint32_t skew = (4 - ((uintptr_t)storage & 3)) & 3;
+	if (size < skew) {
+		return LINEEDIT_SHARED_HISTORY_INIT_FAILED;
+	}
+	storage += skew;
+	size -= skew;
+
+	memset(sh, 0, sizeof(struct lineedit_shared_history));
+	sh->line_len = line_len;
+	sh->slot_size = LINEEDIT_SHARED_HISTORY_SLOT_SIZE(line_len);
+	sh->slots = storage;
+
+	/* Power of two slot count keeps slot positions continuous when the
+	 * sequence number wraps around. */
+	uint32_t count = size / sh->slot_size;
+	if (count == 0) {
+		return LINEEDIT_SHARED_HISTORY_INIT_FAILED;
+	}
+	sh->slot_count = 1;
+	while (sh->slot_count <= (count / 2)) {
+		sh->slot_count *= 2;
+	}
+	memset(storage, 0, sh->slot_count * sh->slot_size);
+
+	return LINEEDIT_SHARED_HISTORY_INIT_OK;
+}
+
+
+int32_t lineedit_set_shared_history(struct lineedit *le, struct lineedit_shared_history *sh) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_SET_SHARED_HISTORY_FAILED;
+	}
+
+	/* The arena is used to hold copies of shared entries. */
+	lineedit_ring_init(&le->history, le->history.buf, le->history.size);
+	le->history_count = 0;
+	le->history_cache_index = -1;
+	le->recall_index = -1;
+	le->shared_history = sh;
+	lineedit_hint_rebuild(le);
+	if (sh != NULL) {
+		lineedit_shared_sync(le);
+	}
+
+	return LINEEDIT_SET_SHARED_HISTORY_OK;
+}
+
+
+/* Delete character at cursor position. */
+static void lineedit_delete(struct lineedit *le) {
+	if (le->cursor < le->text_len) {
+		uint32_t next = lineedit_next_char(le, le->cursor);
+		lineedit_undo_log(le, LINEEDIT_UNDO_DELETE, le->cursor, NULL, next - le->cursor, 1);
+		lineedit_remove(le, le->cursor, next);
+		lineedit_update(le);
+	}
+}
+
+
+/* Start of the row containing position @a pos in the multi-line mode. */
+static uint32_t lineedit_row_start(struct lineedit *le, uint32_t pos) {
+	while (pos > 0 && lineedit_text_char(le, pos - 1) != '\n') {
+		pos--;
+	}
+	return pos;
+}
+
+
+/* End of the row containing position @a pos (its newline or the line end). */
+static uint32_t lineedit_row_end(struct lineedit *le, uint32_t pos) {
+	while (pos < le->text_len && lineedit_text_char(le, pos) != '\n') {
+		pos++;
+	}
+	return pos;
+}
+
+
+/* Move the cursor to the previous (@a up set) or the next row, as close to
+ * its current column as possible. Returns zero if there is no such row. */
+static uint32_t lineedit_row_step(struct lineedit *le, uint32_t up) {
+	uint32_t start = lineedit_row_start(le, le->cursor);
+	uint32_t end;
+
+	if (up) {
+		if (start == 0) {
+			return 0;
+		}
+		end = start - 1;
+		start = lineedit_row_start(le, end);
+	} else {
+		start = lineedit_row_end(le, le->cursor);
+		if (start == le->text_len) {
+			return 0;
+		}
+		start++;
+		end = lineedit_row_end(le, start);
+	}
+
+	uint32_t col = lineedit_text_width(le, lineedit_row_start(le, le->cursor), le->cursor);
+	uint32_t pos = start;
+	while (pos < end) {
+		uint32_t next = lineedit_next_char(le, pos);
+		uint32_t w = lineedit_text_width(le, pos, next);
+		if (w > col) {
+			break;
+		}
+		col -= w;
+		pos = next;
+	}
+	lineedit_set_cursor(le, pos);
+
+	return 1;
+}
+
+
+/* Replace the line with a history entry @a offset entries older than the
+ * currently recalled one (or newer for negative offset). */
+static void lineedit_history_step(struct lineedit *le, int32_t offset) {
+	char *hist_command;
+	if (lineedit_history_recall(le, &hist_command, le->recall_index + offset) == LINEEDIT_HISTORY_RECALL_OK) {
+		lineedit_set_line(le, hist_command);
+		lineedit_update(le);
+		le->recall_index += offset;
+	}
+}
+
+
+/* Find @a n characters of @a needle in @a len characters of @a s. Candidate
+ * positions are located by memchr, which is vectorised by common C libraries.
+ * Returns position of the first occurence or -1. */
+static int32_t lineedit_find(const char *s, uint32_t len, const char *needle, uint32_t n) {
+	if (n == 0) {
+		return 0;
+	}
+
+	const char *p = s;
+	const char *end = s + len;
+	while ((uint32_t)(end - p) >= n) {
+		p = memchr(p, needle[0], (end - p) - n + 1);
+		if (p == NULL) {
+			break;
+		}
+		if (!memcmp(p + 1, needle + 1, n - 1)) {
+			return p - s;
+		}
+		p++;
+	}
+
+	return -1;
+}
+
+
+/* Search history entries starting with entry @a index for the first @a len
+ * characters of the search query. The result is saved for this query
+ * length. Returns 0 if found, -1 otherwise. */
+static int32_t lineedit_search_find(struct lineedit *le, int32_t index, uint32_t len) {
+	struct lineedit_ring *r = &le->history;
+	char *line;
+
+	/* Shared entries can only be copied one by one. */
+	if (le->shared_history != NULL) {
+		for (; index < (int32_t)le->history_count; index++) {
+			if (lineedit_history_recall(le, &line, index) != LINEEDIT_HISTORY_RECALL_OK) {
+				continue;
+			}
+			int32_t pos = lineedit_find(line, strlen(line), le->search_query, len);
+			if (pos >= 0) {
+				le->search_match[len] = index;
+				le->search_pos[len] = pos;
+				return 0;
+			}
+		}
+		return -1;
+	}
+
+	/* Position the recall cache on the first entry, entries are then
+	 * walked sequentially from the newest to the oldest one. */
+	if (index >= (int32_t)le->history_count ||
+	    lineedit_history_recall(le, &line, index) != LINEEDIT_HISTORY_RECALL_OK) {
+		return -1;
+	}
+	uint32_t off = le->history_cache_off;
+	uint32_t steps = 0;
+
+	while (1) {
+		const char *entry = (const char *)lineedit_ring_payload(r, off);
+		int32_t pos = lineedit_find(entry, lineedit_history_len(r, off), le->search_query, len);
+		if (pos >= 0) {
+			le->history_cache_index = index;
+			le->history_cache_off = off;
+			le->search_match[len] = index;
+			le->search_pos[len] = pos;
+			return 0;
+		}
+		if (++index >= (int32_t)le->history_count) {
+			break;
+		}
+		do {
+			if (steps++ >= r->count) {
+				return -1;
+			}
+			off = lineedit_ring_older(r, off);
+		} while (lineedit_ring_deleted(r, off));
+	}
+
+	return -1;
+}
+
+
+/* Display the search label and the entry matching the current query. */
+static void lineedit_search_show(struct lineedit *le) {
+	int32_t index = le->search_match[le->search_len];
+	char *line = NULL;
+
+	if (index >= 0 && lineedit_history_recall(le, &line, index) == LINEEDIT_HISTORY_RECALL_OK) {
+		le->search_line = line;
+		le->search_line_len = strlen(line);
+	} else {
+		le->search_line = NULL;
+		le->search_line_len = 0;
+	}
+
+	uint32_t failed = le->search_failed_len > 0 && le->search_len >= le->search_failed_len;
+	int n = snprintf(le->search_label, sizeof(le->search_label), "(%sreverse-i-search)`%.*s': ",
+		failed ? "failed " : "", (int)le->search_len, le->search_query);
+
+	/* The label has to fit into the shadow copy. */
+	le->search_label_len = (n < 0) ? 0 : (uint32_t)n;
+	if (le->search_label_len >= sizeof(le->search_label)) {
+		le->search_label_len = sizeof(le->search_label) - 1;
+	}
+	if (le->search_label_len > le->len) {
+		le->search_label_len = le->len;
+		while (le->search_label_len > 0 && LINEEDIT_UTF8_CONT(le->search_label[le->search_label_len])) {
+			le->search_label_len--;
+		}
+	}
+
+	lineedit_update(le);
+}
+
+
+/* Enter the incremental search mode. The prompt is replaced by the search
+ * label. */
+static void lineedit_search_start(struct lineedit *le) {
+	/* Password-like lines are not saved, do not reveal the history. */
+	if (le->pwchar != 0) {
+		return;
+	}
+
+	if (le->shared_history != NULL && le->recall_index == -1) {
+		lineedit_shared_sync(le);
+	}
+
+	le->search = 1;
+	le->search_len = 0;
+	le->search_failed_len = 0;
+	le->search_match[0] = -1;
+	le->search_pos[0] = 0;
+	le->shadow_valid = 0;
+	lineedit_search_show(le);
+}
+
+
+/* Leave the search mode. If @a accept is set, the matching entry replaces
+ * the edited line, otherwise the line is left untouched. */
+static void lineedit_search_stop(struct lineedit *le, uint32_t accept) {
+	int32_t index = le->search_match[le->search_len];
+
+	if (accept && le->search_line != NULL) {
+		lineedit_set_line(le, le->search_line);
+		lineedit_cursor_move(le, le->search_pos[le->search_len]);
+		le->recall_index = index;
+	}
+
+	le->search = 0;
+	le->search_line = NULL;
+	lineedit_refresh(le);
+}
+
+
+/* Add a character (@a n bytes of @a s) to the search query, searching
+ * further from the current match if needed. */
+static void lineedit_search_char(struct lineedit *le, const char *s, uint32_t n) {
+	if ((le->search_len + n) > LINEEDIT_SEARCH_LEN) {
+		return;
+	}
+
+	uint32_t len = le->search_len;
+	memcpy(le->search_query + len, s, n);
+	le->search_len = len + n;
+
+	/* Entries newer than the current match do not contain the shorter
+	 * query, they cannot contain the longer one. */
+	int32_t from = (le->search_match[len] >= 0) ? le->search_match[len] : 0;
+	if (le->search_failed_len > 0 || lineedit_search_find(le, from, len + n)) {
+		if (le->search_failed_len == 0) {
+			le->search_failed_len = len + n;
+		}
+		le->search_match[len + n] = le->search_match[len];
+		le->search_pos[len + n] = le->search_pos[len];
+	}
+
+	lineedit_search_show(le);
+}
+
+
+/* Process a control character in the search mode. Returns 0 if the search
+ * was finished and the character should be processed as usual. */
+static uint32_t lineedit_search_control(struct lineedit *le, int c) {
+	uint32_t len = le->search_len;
+
+	switch (c) {
+		/* Ctrl+R, find the next older match */
+		case 0x12:
+			if (len > 0 && le->search_failed_len == 0) {
+				if (lineedit_search_find(le, le->search_match[len] + 1, len)) {
+					le->search_failed_len = len;
+				}
+				lineedit_search_show(le);
+			}
+			return 1;
+
+		/* Ctrl+G, cancel the search */
+		case 0x07:
+			lineedit_search_stop(le, 0);
+			return 1;
+
+		/* backspace, return to the previous query */
+		case 0x08:
+		case 0x7f:
+			if (len > 0) {
+				/* Remove the whole last character. */
+				do {
+					len--;
+				} while (len > 0 && LINEEDIT_UTF8_CONT(le->search_query[len]));
+				le->search_len = len;
+				if (le->search_len < le->search_failed_len) {
+					le->search_failed_len = 0;
+				}
+				lineedit_search_show(le);
+			}
+			return 1;
+
+		default:
+			lineedit_search_stop(le, 1);
+			return 0;
+	}
+}
+
+
+/* Classes of input characters. Each class triggers the same transition of
+ * the input decoder in every state. */
+enum lineedit_class {
+	CL_C0, CL_BEL, CL_CAN, CL_ESC, CL_INTERMEDIATE, CL_DIGIT, CL_SEPARATOR,
+	CL_PRIVATE, CL_CSI, CL_STRING, CL_SS3, CL_ST, CL_FINAL, CL_DEL,
+	CL_C1_CSI, CL_C1_STRING, CL_C1_ST, CL_C1, CL_HIGH, CL_UTF8, CL_COUNT
+};
+
+static const uint8_t lineedit_classes[256] = {
+	[0x00 ... 0x06] = CL_C0,
+	[0x07] = CL_BEL,
+	[0x08 ... 0x17] = CL_C0,
+	[0x18] = CL_CAN,
+	[0x19] = CL_C0,
+	[0x1a] = CL_CAN,
+	[0x1b] = CL_ESC,
+	[0x1c ... 0x1f] = CL_C0,
+	[0x20 ... 0x2f] = CL_INTERMEDIATE,
+	[0x30 ... 0x39] = CL_DIGIT,
+	[0x3a ... 0x3b] = CL_SEPARATOR,
+	[0x3c ... 0x3f] = CL_PRIVATE,
+	[0x40 ... 0x4e] = CL_FINAL,
+	['O'] = CL_SS3,
+	['P'] = CL_STRING,
+	[0x51 ... 0x57] = CL_FINAL,
+	['X'] = CL_STRING,
+	[0x59 ... 0x5a] = CL_FINAL,
+	['['] = CL_CSI,
+	['\\'] = CL_ST,
+	[']'] = CL_STRING,
+	['^'] = CL_STRING,
+	['_'] = CL_STRING,
+	[0x60 ... 0x7e] = CL_FINAL,
+	[0x7f] = CL_DEL,
+	[0x80 ... 0x8f] = CL_C1,
+	[0x90] = CL_C1_STRING,
+	[0x91 ... 0x97] = CL_C1,
+	[0x98] = CL_C1_STRING,
+	[0x99 ... 0x9a] = CL_C1,
+	[0x9b] = CL_C1_CSI,
+	[0x9c] = CL_C1_ST,
+	[0x9d ... 0x9f] = CL_C1_STRING,
+	[0xa0 ... 0xff] = CL_HIGH,
+};
+
+
+/* Actions performed by the input decoder on a transition. */
+enum lineedit_action {
+	ACT_NONE, ACT_PRINT, ACT_EXECUTE, ACT_CLEAR, ACT_PARAM, ACT_SEPARATOR,
+	ACT_IGNORE, ACT_CSI_DISPATCH, ACT_SS3_DISPATCH, ACT_ESC_DISPATCH
+};
+
+/* Transition table of the input decoder indexed by the current state and
+ * a character class. Each entry contains the action in the upper nibble and
+ * the next state in the lower one. Missing entries cancel the sequence. */
+#define T(action, state) (((action) << 4) | (state))
+#define T_ANY_FINAL(action, state) \
+	[CL_CSI] = T(action, state), [CL_STRING] = T(action, state), \
+	[CL_SS3] = T(action, state), [CL_ST] = T(action, state), \
+	[CL_FINAL] = T(action, state)
+
+static const uint8_t lineedit_transitions[ESC_STATES][CL_COUNT] = {
+	[ESC_NONE] = {
+		[CL_C0] = T(ACT_EXECUTE, ESC_NONE),
+		[CL_BEL] = T(ACT_EXECUTE, ESC_NONE),
+		[CL_ESC] = T(ACT_CLEAR, ESC_ESC),
+		[CL_INTERMEDIATE] = T(ACT_PRINT, ESC_NONE),
+		[CL_DIGIT] = T(ACT_PRINT, ESC_NONE),
+		[CL_SEPARATOR] = T(ACT_PRINT, ESC_NONE),
+		[CL_PRIVATE] = T(ACT_PRINT, ESC_NONE),
+		T_ANY_FINAL(ACT_PRINT, ESC_NONE),
+		[CL_DEL] = T(ACT_EXECUTE, ESC_NONE),
+		[CL_C1_CSI] = T(ACT_CLEAR, ESC_CSI),
+		[CL_C1_STRING] = T(ACT_NONE, ESC_OSC),
+		[CL_UTF8] = T(ACT_PRINT, ESC_NONE),
+	},
+	[ESC_ESC] = {
+		[CL_C0] = T(ACT_EXECUTE, ESC_NONE),
+		[CL_BEL] = T(ACT_EXECUTE, ESC_NONE),
+		[CL_ESC] = T(ACT_CLEAR, ESC_ESC),
+		[CL_INTERMEDIATE] = T(ACT_ESC_DISPATCH, ESC_NONE),
+		[CL_DIGIT] = T(ACT_ESC_DISPATCH, ESC_NONE),
+		[CL_SEPARATOR] = T(ACT_ESC_DISPATCH, ESC_NONE),
+		[CL_PRIVATE] = T(ACT_ESC_DISPATCH, ESC_NONE),
+		[CL_CSI] = T(ACT_CLEAR, ESC_CSI),
+		[CL_STRING] = T(ACT_NONE, ESC_OSC),
+		[CL_SS3] = T(ACT_CLEAR, ESC_SS3),
+		[CL_FINAL] = T(ACT_ESC_DISPATCH, ESC_NONE),
+		[CL_DEL] = T(ACT_ESC_DISPATCH, ESC_NONE),
+		[CL_C1_CSI] = T(ACT_CLEAR, ESC_CSI),
+		[CL_C1_STRING] = T(ACT_NONE, ESC_OSC),
+	},
+	[ESC_CSI] = {
+		[CL_C0] = T(ACT_EXECUTE, ESC_CSI),
+		[CL_BEL] = T(ACT_EXECUTE, ESC_CSI),
+		[CL_ESC] = T(ACT_CLEAR, ESC_ESC),
+		[CL_INTERMEDIATE] = T(ACT_IGNORE, ESC_CSI_INTERMEDIATE),
+		[CL_DIGIT] = T(ACT_PARAM, ESC_CSI),
+		[CL_SEPARATOR] = T(ACT_SEPARATOR, ESC_CSI),
+		[CL_PRIVATE] = T(ACT_IGNORE, ESC_CSI),
+		T_ANY_FINAL(ACT_CSI_DISPATCH, ESC_NONE),
+		[CL_DEL] = T(ACT_NONE, ESC_CSI),
+		[CL_C1_CSI] = T(ACT_CLEAR, ESC_CSI),
+		[CL_C1_STRING] = T(ACT_NONE, ESC_OSC),
+		[CL_HIGH] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_UTF8] = T(ACT_NONE, ESC_CSI_IGNORE),
+	},
+	[ESC_CSI_INTERMEDIATE] = {
+		[CL_C0] = T(ACT_EXECUTE, ESC_CSI_INTERMEDIATE),
+		[CL_BEL] = T(ACT_EXECUTE, ESC_CSI_INTERMEDIATE),
+		[CL_ESC] = T(ACT_CLEAR, ESC_ESC),
+		[CL_INTERMEDIATE] = T(ACT_NONE, ESC_CSI_INTERMEDIATE),
+		[CL_DIGIT] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_SEPARATOR] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_PRIVATE] = T(ACT_NONE, ESC_CSI_IGNORE),
+		T_ANY_FINAL(ACT_CSI_DISPATCH, ESC_NONE),
+		[CL_DEL] = T(ACT_NONE, ESC_CSI_INTERMEDIATE),
+		[CL_C1_CSI] = T(ACT_CLEAR, ESC_CSI),
+		[CL_C1_STRING] = T(ACT_NONE, ESC_OSC),
+		[CL_HIGH] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_UTF8] = T(ACT_NONE, ESC_CSI_IGNORE),
+	},
+	[ESC_CSI_IGNORE] = {
+		[CL_C0] = T(ACT_EXECUTE, ESC_CSI_IGNORE),
+		[CL_BEL] = T(ACT_EXECUTE, ESC_CSI_IGNORE),
+		[CL_ESC] = T(ACT_CLEAR, ESC_ESC),
+		[CL_INTERMEDIATE] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_DIGIT] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_SEPARATOR] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_PRIVATE] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_DEL] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_C1_CSI] = T(ACT_CLEAR, ESC_CSI),
+		[CL_C1_STRING] = T(ACT_NONE, ESC_OSC),
+		[CL_HIGH] = T(ACT_NONE, ESC_CSI_IGNORE),
+		[CL_UTF8] = T(ACT_NONE, ESC_CSI_IGNORE),
+	},
+	[ESC_SS3] = {
+		[CL_C0] = T(ACT_EXECUTE, ESC_SS3),
+		[CL_BEL] = T(ACT_EXECUTE, ESC_SS3),
+		[CL_ESC] = T(ACT_CLEAR, ESC_ESC),
+		[CL_DIGIT] = T(ACT_PARAM, ESC_SS3),
+		T_ANY_FINAL(ACT_SS3_DISPATCH, ESC_NONE),
+		[CL_C1_CSI] = T(ACT_CLEAR, ESC_CSI),
+		[CL_C1_STRING] = T(ACT_NONE, ESC_OSC),
+	},
+	[ESC_OSC] = {
+		/* Control strings never contain line controls, receiving one means
+		 * the terminator was lost. */
+		[CL_C0] = T(ACT_EXECUTE, ESC_NONE),
+		[CL_ESC] = T(ACT_NONE, ESC_OSC_ESC),
+		[CL_INTERMEDIATE] = T(ACT_NONE, ESC_OSC),
+		[CL_DIGIT] = T(ACT_NONE, ESC_OSC),
+		[CL_SEPARATOR] = T(ACT_NONE, ESC_OSC),
+		[CL_PRIVATE] = T(ACT_NONE, ESC_OSC),
+		T_ANY_FINAL(ACT_NONE, ESC_OSC),
+		[CL_DEL] = T(ACT_NONE, ESC_OSC),
+		[CL_C1] = T(ACT_NONE, ESC_OSC),
+		[CL_C1_CSI] = T(ACT_NONE, ESC_OSC),
+		[CL_C1_STRING] = T(ACT_NONE, ESC_OSC),
+		[CL_HIGH] = T(ACT_NONE, ESC_OSC),
+		[CL_UTF8] = T(ACT_NONE, ESC_OSC),
+	},
+	[ESC_OSC_ESC] = {
+		[CL_ESC] = T(ACT_NONE, ESC_OSC_ESC),
+		[CL_CSI] = T(ACT_CLEAR, ESC_CSI),
+	},
+};
+
+#undef T_ANY_FINAL
+#undef T
+
+
+/* Keys identified by the final character of CSI and SS3 sequences. */
+static const uint8_t lineedit_final_keys[0x3f] = {
+	['A' - 0x40] = LINEEDIT_KEY_UP,
+	['B' - 0x40] = LINEEDIT_KEY_DOWN,
+	['C' - 0x40] = LINEEDIT_KEY_RIGHT,
+	['D' - 0x40] = LINEEDIT_KEY_LEFT,
+	['F' - 0x40] = LINEEDIT_KEY_END,
+	['H' - 0x40] = LINEEDIT_KEY_HOME,
+	['P' - 0x40] = LINEEDIT_KEY_F1,
+	['Q' - 0x40] = LINEEDIT_KEY_F2,
+	['R' - 0x40] = LINEEDIT_KEY_F3,
+	['S' - 0x40] = LINEEDIT_KEY_F4,
+};
+
+/* Keys identified by the first parameter of a CSI sequence ending with '~'. */
+static const uint8_t lineedit_tilde_keys[25] = {
+	[1] = LINEEDIT_KEY_HOME,
+	[2] = LINEEDIT_KEY_INSERT,
+	[3] = LINEEDIT_KEY_DELETE,
+	[4] = LINEEDIT_KEY_END,
+	[5] = LINEEDIT_KEY_PAGE_UP,
+	[6] = LINEEDIT_KEY_PAGE_DOWN,
+	[7] = LINEEDIT_KEY_HOME,
+	[8] = LINEEDIT_KEY_END,
+	[11] = LINEEDIT_KEY_F1,
+	[12] = LINEEDIT_KEY_F2,
+	[13] = LINEEDIT_KEY_F3,
+	[14] = LINEEDIT_KEY_F4,
+	[15] = LINEEDIT_KEY_F5,
+	[17] = LINEEDIT_KEY_F6,
+	[18] = LINEEDIT_KEY_F7,
+	[19] = LINEEDIT_KEY_F8,
+	[20] = LINEEDIT_KEY_F9,
+	[21] = LINEEDIT_KEY_F10,
+	[23] = LINEEDIT_KEY_F11,
+	[24] = LINEEDIT_KEY_F12,
+};
+
+
+/* States of a bracketed paste being received, a CR was the last newline
+ * character pasted in the latter one. */
+#define LINEEDIT_PASTE_TEXT 1
+#define LINEEDIT_PASTE_CR 2
+
+/* Process a control character. */
+static int32_t lineedit_control(struct lineedit *le, int c) {
+	if (le->paste) {
+		/* Only newlines and tabs are handled inside a pasted text. */
+		if (c == 0x09) {
+			lineedit_insert_char(le, ' ');
+			return LINEEDIT_OK;
+		}
+		if (c < 0x0a || c > 0x0d || le->paste_newline == LINEEDIT_PASTE_NEWLINE_IGNORE) {
+			return LINEEDIT_OK;
+		}
+		if (le->paste_newline == LINEEDIT_PASTE_NEWLINE_KEEP && le->multiline) {
+			/* CR LF is a single newline. */
+			if (c != 0x0a || le->paste != LINEEDIT_PASTE_CR || le->cursor == 0 || lineedit_text_char(le, le->cursor - 1) != '\n') {
+				lineedit_insert_run(le, "\n", 1, 1);
+			}
+			le->paste = (c == 0x0d) ? LINEEDIT_PASTE_CR : LINEEDIT_PASTE_TEXT;
+			return LINEEDIT_OK;
+		}
+		if (le->paste_newline != LINEEDIT_PASTE_NEWLINE_ENTER) {
+			lineedit_insert_char(le, ' ');
+			return LINEEDIT_OK;
+		}
+		/* Show the line pasted so far before finishing it. */
+		lineedit_update(le);
+	}
+
+	if (le->search && lineedit_search_control(le, c)) {
+		return LINEEDIT_OK;
+	}
+
+	switch (c) {
+		/* check for TAB, complete the command if a vocabulary is set */
+		case 0x09:
+			if (le->completion != NULL) {
+				lineedit_complete(le);
+				return LINEEDIT_OK;
+			}
+			return LINEEDIT_TAB;
+
+		/* check for line feed, Ctrl+J inserts a newline in the
+		 * multi-line mode */
+		case 0x0a:
+			if (le->multiline && !le->paste) {
+				lineedit_insert_run(le, "\n", 1, 1);
+				break;
+			}
+			/* Fall through. */
+		case 0x0b:
+		case 0x0d: {
+			/* save current line to the history and reset recall
+			 * index to point to the current line (-1) */
+			char *line;
+			lineedit_hint_clear(le);
+			lineedit_get_line(le, &line);
+			lineedit_history_append(le, line);
+			le->recall_index = -1;
+
+			/* The application is going to continue on a new line,
+			 * it has to start below all rows. */
+			if (le->multiline) {
+				lineedit_cursor_move(le, le->text_len);
+				lineedit_update(le);
+			}
+			le->shadow_row = 0;
+
+			/* The terminal contents are not known anymore. */
+			le->shadow_valid = 0;
+			return LINEEDIT_ENTER;
+		}
+
+		/* Ctrl+L, redraw the line */
+		case 0x0c:
+			lineedit_refresh(le);
+			break;
+
+		/* Ctrl+R, incremental history search */
+		case 0x12:
+			lineedit_search_start(le);
+			break;
+
+		/* Ctrl+A and Ctrl+E, move to the line start or end (accepting
+		 * the suggestion there) */
+		case 0x01:
+			lineedit_set_cursor(le, 0);
+			break;
+		case 0x05:
+			if (!lineedit_hint_accept(le)) {
+				lineedit_set_cursor(le, le->text_len);
+			}
+			break;
+
+		/* Ctrl+_ and Ctrl+Y, undo and redo an edit */
+		case 0x1f:
+			lineedit_undo(le);
+			break;
+		case 0x19:
+			lineedit_redo(le);
+			break;
+
+		/* check for backspace and DEL */
+		case 0x08:
+		case 0x7f:
+			/* Do not check return value, if we are unable to do backspace,
+			 * we just ignore it. */
+			lineedit_backspace(le);
+			break;
+
+		default:
+			break;
+	}
+
+	return LINEEDIT_OK;
+}
+
+
+/* Process a key decoded from an escape sequence. */
+static void lineedit_key(struct lineedit *le, enum lineedit_key key, uint32_t mod) {
+	le->key = key;
+	le->key_mod = mod;
+
+	/* Keys finish the search and are processed as usual. */
+	if (le->search) {
+		lineedit_search_stop(le, 1);
+	}
+
+	/* Nothing but the end of a pasted text is expected inside it. */
+	if (le->paste) {
+		if (key == LINEEDIT_KEY_PASTE_END) {
+			le->paste = 0;
+			lineedit_update(le);
+		}
+		return;
+	}
+
+	switch (key) {
+		case LINEEDIT_KEY_UP:
+			/* previous row or history entry */
+			if (!le->multiline || !lineedit_row_step(le, 1)) {
+				lineedit_history_step(le, 1);
+			}
+			break;
+
+		case LINEEDIT_KEY_DOWN:
+			/* next row or history entry */
+			if (!le->multiline || !lineedit_row_step(le, 0)) {
+				lineedit_history_step(le, -1);
+			}
+			break;
+
+		case LINEEDIT_KEY_RIGHT:
+			if (mod & (LINEEDIT_MOD_CTRL | LINEEDIT_MOD_ALT)) {
+				lineedit_set_cursor(le, lineedit_word_right(le));
+			} else if (le->cursor < le->text_len) {
+				lineedit_set_cursor(le, lineedit_next_char(le, le->cursor));
+			} else {
+				lineedit_hint_accept(le);
+			}
+			break;
+
+		case LINEEDIT_KEY_LEFT:
+			if (mod & (LINEEDIT_MOD_CTRL | LINEEDIT_MOD_ALT)) {
+				lineedit_set_cursor(le, lineedit_word_left(le));
+			} else if (le->cursor > 0) {
+				lineedit_set_cursor(le, lineedit_prev_char(le, le->cursor));
+			}
+			break;
+
+		case LINEEDIT_KEY_HOME:
+			lineedit_set_cursor(le, 0);
+			break;
+
+		case LINEEDIT_KEY_END:
+			if (!lineedit_hint_accept(le)) {
+				lineedit_set_cursor(le, le->text_len);
+			}
+			break;
+
+		case LINEEDIT_KEY_DELETE:
+			lineedit_delete(le);
+			break;
+
+		case LINEEDIT_KEY_PASTE_START:
+			/* The line is updated once when the paste ends and
+			 * the pasted text is undone at once. */
+			le->paste = LINEEDIT_PASTE_TEXT;
+			le->undo_merge = 0;
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+/* Process a key pressed together with Alt (ESC followed by a character). */
+static void lineedit_alt_key(struct lineedit *le, int c) {
+	if (le->paste) {
+		return;
+	}
+	if (le->search) {
+		lineedit_search_stop(le, 1);
+	}
+
+	switch (c) {
+		/* Alt+B and Alt+F move to the previous or next word */
+		case 'b':
+			lineedit_set_cursor(le, lineedit_word_left(le));
+			break;
+		case 'f':
+			lineedit_set_cursor(le, lineedit_word_right(le));
+			break;
+		default:
+			break;
+	}
+}
+
+
+/* Modifiers are encoded in the second parameter as their sum plus one. */
+static uint32_t lineedit_csi_mod(struct lineedit *le, uint32_t i) {
+	if (le->csi_count > i && le->csi_params[i] > 1) {
+		return (le->csi_params[i] - 1) & (LINEEDIT_MOD_SHIFT | LINEEDIT_MOD_ALT | LINEEDIT_MOD_CTRL);
+	}
+	return 0;
+}
+
+
+static void lineedit_csi_dispatch(struct lineedit *le, int c) {
+	/* Sequences with private markers, intermediate characters or too
+	 * many parameters are not keys. */
+	if (le->csi_ignore || le->csi_count > LINEEDIT_CSI_PARAMS) {
+		return;
+	}
+
+	uint32_t p = (le->csi_count > 0) ? le->csi_params[0] : 0;
+	if (c == '~') {
+		if (p < sizeof(lineedit_tilde_keys)) {
+			lineedit_key(le, lineedit_tilde_keys[p], lineedit_csi_mod(le, 1));
+		} else if (p == 200) {
+			lineedit_key(le, LINEEDIT_KEY_PASTE_START, 0);
+		} else if (p == 201) {
+			lineedit_key(le, LINEEDIT_KEY_PASTE_END, 0);
+		}
+		return;
+	}
+
+	if (c > 0x40 && (c - 0x40) < (int)sizeof(lineedit_final_keys)) {
+		lineedit_key(le, lineedit_final_keys[c - 0x40], lineedit_csi_mod(le, 1));
+	}
+}
+
+
+/* Get keypress start time if latency is measured. */
+static uint32_t lineedit_stats_start(struct lineedit *le) {
+#if LINEEDIT_STATS
+	if (le->timestamp != NULL) {
+		return le->timestamp(le->timestamp_ctx);
+	}
+#endif
+	return 0;
+}
+
+
+/* Count @a keypresses processed since @a start and add the processing time
+ * to the latency histogram. */
+static void lineedit_stats_finish(struct lineedit *le, uint32_t start, uint32_t keypresses) {
+#if LINEEDIT_STATS
+	le->stats.keypresses += keypresses;
+	if (le->timestamp != NULL) {
+		uint32_t t = le->timestamp(le->timestamp_ctx) - start;
+		uint32_t bucket = 0;
+		while (t > 0 && bucket < (LINEEDIT_STATS_LATENCY_BUCKETS - 1)) {
+			t >>= 1;
+			bucket++;
+		}
+		le->stats.latency[bucket]++;
+	}
+#else
+	(void)le;
+	(void)start;
+	(void)keypresses;
+#endif
+}
+
+
+static int32_t lineedit_keypress_process(struct lineedit *le, int c) {
+	/* EOF or anything else not fitting into a byte is ignored. */
+	if (c < 0 || c > 0xff) {
+		return LINEEDIT_OK;
+	}
+
+	/* Bytes above 0x7f are parts of UTF-8 characters, not C1 controls.
+	 * Anything else interrupts a partially received character. */
+	uint8_t cl = lineedit_classes[c];
+	if (c < 0x80) {
+		le->utf8_len = 0;
+	} else if (le->utf8) {
+		cl = CL_UTF8;
+	}
+
+	uint8_t t = lineedit_transitions[le->escape][cl];
+	le->escape = t & 0x0f;
+
+	switch (t >> 4) {
+		case ACT_PRINT: {
+			/* Do not check return value, if we are unable to insert it,
+			 * we just ignore the character. */
+			char ch = c;
+			const char *s = &ch;
+			uint32_t n = 1;
+			if (c >= 0x80) {
+				s = (const char *)le->utf8_seq;
+				n = lineedit_utf8_collect(le, c);
+				if (n == 0) {
+					break;
+				}
+			}
+			if (le->search) {
+				lineedit_search_char(le, s, n);
+			} else {
+				lineedit_insert_run(le, s, n, c < 0x80);
+			}
+			break;
+		}
+
+		case ACT_EXECUTE:
+			return lineedit_control(le, c);
+
+		case ACT_CLEAR:
+			le->csi_count = 0;
+			le->csi_ignore = 0;
+			le->csi_params[0] = 0;
+			break;
+
+		case ACT_PARAM: {
+			/* Parameters saturate, excess parameters are only counted. */
+			if (le->csi_count == 0) {
+				le->csi_count = 1;
+			}
+			if (le->csi_count <= LINEEDIT_CSI_PARAMS) {
+				uint16_t *p = &le->csi_params[le->csi_count - 1];
+				*p = (*p < 6553) ? (*p * 10 + (c - '0')) : UINT16_MAX;
+			}
+			break;
+		}
+
+		case ACT_SEPARATOR:
+			le->csi_count = (le->csi_count == 0) ? 2 : (le->csi_count + 1);
+			if (le->csi_count <= LINEEDIT_CSI_PARAMS) {
+				le->csi_params[le->csi_count - 1] = 0;
+			} else {
+				le->csi_count = LINEEDIT_CSI_PARAMS + 1;
+			}
+			break;
+
+		case ACT_IGNORE:
+			le->csi_ignore = 1;
+			break;
+
+		case ACT_CSI_DISPATCH:
+			lineedit_csi_dispatch(le, c);
+			break;
+
+		case ACT_SS3_DISPATCH:
+			/* Modifiers are sometimes sent as a parameter of SS3. */
+			if (c > 0x40 && (c - 0x40) < (int)sizeof(lineedit_final_keys)) {
+				lineedit_key(le, lineedit_final_keys[c - 0x40], lineedit_csi_mod(le, 0));
+			}
+			break;
+
+		case ACT_ESC_DISPATCH:
+			lineedit_alt_key(le, c);
+			break;
+
+		default:
+			break;
+	}
+
+	return LINEEDIT_OK;
+}
+
+
+int32_t lineedit_keypress(struct lineedit *le, int c) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_FAILED;
+	}
+
+	uint32_t start = lineedit_stats_start(le);
+
+	/* Whole keypress output is passed to the print handler at once. */
+	lineedit_output_hold(le);
+	int32_t ret = lineedit_keypress_process(le, c);
+	lineedit_output_release(le);
+
+	lineedit_stats_finish(le, start, 1);
+
+	return ret;
+}
+
+
+int32_t lineedit_get_key(struct lineedit *le, enum lineedit_key *key, uint32_t *mod) {
+	if (u_assert(le != NULL) ||
+	    u_assert(key != NULL) ||
+	    u_assert(mod != NULL)) {
+		return LINEEDIT_GET_KEY_FAILED;
+	}
+
+	*key = le->key;
+	*mod = le->key_mod;
+
+	return LINEEDIT_GET_KEY_OK;
+}
+
+
+int32_t lineedit_backspace(struct lineedit *le) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_BACKSPACE_FAILED;
+	}
+
+	/* we are going to remove 1 character at cursor position,
+	 * check if we have anything to remove */
+	if (le->text_len == 0 || le->cursor == 0) {
+		return LINEEDIT_BACKSPACE_FAILED;
+	}
+
+	/* remove the character by extending the gap over it */
+	uint32_t prev = lineedit_prev_char(le, le->cursor);
+	lineedit_undo_log(le, LINEEDIT_UNDO_DELETE, prev, NULL, le->cursor - prev, 1);
+	lineedit_remove(le, prev, le->cursor);
+
+	lineedit_update(le);
+
+	return LINEEDIT_BACKSPACE_OK;
+}
+
+
+int32_t lineedit_set_undo_buffer(struct lineedit *le, uint8_t *buf, uint32_t size) {
+	if (u_assert(le != NULL) ||
+	    u_assert(buf != NULL || size == 0)) {
+		return LINEEDIT_SET_UNDO_BUFFER_FAILED;
+	}
+
+	lineedit_ring_init(&le->undo, size > 0 ? buf : NULL, size);
+	lineedit_undo_reset(le);
+
+	return LINEEDIT_SET_UNDO_BUFFER_OK;
+}
+
+
+int32_t lineedit_undo(struct lineedit *le) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_UNDO_FAILED;
+	}
+
+	if (le->undo_done == 0) {
+		return LINEEDIT_UNDO_FAILED;
+	}
+
+	/* Revert records of the newest step from the last one. */
+	uint32_t type;
+	do {
+		uint32_t off = lineedit_ring_older(&le->undo, le->undo_pos);
+		type = lineedit_undo_type(&le->undo, off);
+		if (!lineedit_undo_apply(le, off, 1)) {
+			lineedit_undo_reset(le);
+			break;
+		}
+		le->undo_pos = off;
+		le->undo_done--;
+	} while ((type & LINEEDIT_UNDO_JOIN) && le->undo_done > 0);
+	le->undo_merge = 0;
+
+	lineedit_update(le);
+
+	return LINEEDIT_UNDO_OK;
+}
+
+
+int32_t lineedit_redo(struct lineedit *le) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_REDO_FAILED;
+	}
+
+	if (le->undo_done == le->undo.count) {
+		return LINEEDIT_REDO_FAILED;
+	}
+
+	/* Apply records of the next step, it ends before a record not joined
+	 * to it. */
+	do {
+		if (!lineedit_undo_apply(le, le->undo_pos, 0)) {
+			lineedit_undo_reset(le);
+			break;
+		}
+		le->undo_pos = lineedit_ring_newer(&le->undo, le->undo_pos);
+		le->undo_done++;
+	} while (le->undo_done < le->undo.count && (lineedit_undo_type(&le->undo, le->undo_pos) & LINEEDIT_UNDO_JOIN));
+	le->undo_merge = 0;
+
+	lineedit_update(le);
+
+	return LINEEDIT_REDO_OK;
+}
+
+
+/* Return the length of the run of printable characters (32 to 126) at the
+ * beginning of @a s. Eight bytes are checked at once, a byte-wise scan is
+ * used only to locate the first non-printable character. */
+static uint32_t lineedit_printable_run(const char *s, uint32_t len) {
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+	uint32_t i = 0;
+
+	while ((len - i) >= sizeof(uint64_t)) {
+		uint64_t w;
+		memcpy(&w, s + i, sizeof(w));
+		/* Set high bit of every byte < 32 or > 126 (including bytes with
+		 * the high bit already set). */
+		uint64_t below = (w - ones * 32) & ~w;
+		uint64_t above = (w + ones * (127 - 126)) | w;
+		if ((below | above) & highs) {
+			break;
+		}
+		i += sizeof(uint64_t);
+	}
+	while (i < len && s[i] >= 32 && s[i] <= 126) {
+		i++;
+	}
+
+	return i;
+}
+
+
+int32_t lineedit_insert_char(struct lineedit *le, int c) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_INSERT_CHAR_FAILED;
+	}
+
+	if (c >= 0x80 && c <= 0xff && le->utf8) {
+		uint32_t n = lineedit_utf8_collect(le, c);
+		if (n == 0) {
+			return LINEEDIT_INSERT_CHAR_OK;
+		}
+		return lineedit_insert_run(le, (const char *)le->utf8_seq, n, 0);
+	}
+
+	/* Only printable characters can be inserted. */
+	if (c < 32 || c > 127) {
+		return LINEEDIT_INSERT_CHAR_FAILED;
+	}
+
+	char ch = c;
+	le->utf8_len = 0;
+	return lineedit_insert_run(le, &ch, 1, 1);
+}
+
+
+int32_t lineedit_feed(struct lineedit *le, const char *buf, uint32_t len, uint32_t *consumed) {
+	if (u_assert(le != NULL) ||
+	    u_assert(buf != NULL) ||
+	    u_assert(consumed != NULL)) {
+		return LINEEDIT_FAILED;
+	}
+
+	int32_t ret = LINEEDIT_OK;
+	uint32_t i = 0;
+	uint32_t start = lineedit_stats_start(le);
+
+	lineedit_output_hold(le);
+	while (i < len) {
+		/* Fast path, insert runs of printable characters at once. Escape
+		 * sequences need to be processed byte by byte. */
+		if (le->escape == ESC_NONE && !le->search) {
+			uint32_t run = lineedit_printable_run(buf + i, len - i);
+			if (run > 0) {
+				le->utf8_len = 0;
+				lineedit_insert_run(le, buf + i, run, 1);
+				i += run;
+				continue;
+			}
+			if (le->utf8 && le->utf8_len == 0) {
+				run = lineedit_utf8_run(buf + i, len - i);
+				if (run > 0) {
+					lineedit_insert_run(le, buf + i, run, 0);
+					i += run;
+					continue;
+				}
+			}
+		}
+
+		ret = lineedit_keypress_process(le, (unsigned char)buf[i]);
+		i++;
+		if (ret == LINEEDIT_ENTER || ret == LINEEDIT_TAB) {
+			break;
+		}
+	}
+	lineedit_output_release(le);
+
+	lineedit_stats_finish(le, start, i);
+
+	*consumed = i;
+	return ret;
+}
+
+
+int32_t lineedit_get_stats(struct lineedit *le, struct lineedit_stats *stats) {
+	if (u_assert(le != NULL) ||
+	    u_assert(stats != NULL)) {
+		return LINEEDIT_GET_STATS_FAILED;
+	}
+
+#if LINEEDIT_STATS
+	*stats = le->stats;
+	return LINEEDIT_GET_STATS_OK;
+#else
+	return LINEEDIT_GET_STATS_FAILED;
+#endif
+}
+
+
+int32_t lineedit_reset_stats(struct lineedit *le) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_RESET_STATS_FAILED;
+	}
+
+#if LINEEDIT_STATS
+	memset(&le->stats, 0, sizeof(le->stats));
+	return LINEEDIT_RESET_STATS_OK;
+#else
+	return LINEEDIT_RESET_STATS_FAILED;
+#endif
+}
+
+
+int32_t lineedit_set_timestamp(struct lineedit *le, uint32_t (*timestamp)(void *ctx), void *ctx) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_SET_TIMESTAMP_FAILED;
+	}
+
+#if LINEEDIT_STATS
+	le->timestamp = timestamp;
+	le->timestamp_ctx = ctx;
+	return LINEEDIT_SET_TIMESTAMP_OK;
+#else
+	(void)timestamp;
+	(void)ctx;
+	return LINEEDIT_SET_TIMESTAMP_FAILED;
+#endif
+}
+
+
+int32_t lineedit_set_print_handler(struct lineedit *le, int32_t (*print_handler)(const char *line, void *ctx), void *ctx) {
+	if (u_assert(le != NULL) ||
+	    u_assert(print_handler != NULL)) {
+		return LINEEDIT_SET_PRINT_HANDLER_FAILED;
+	}
+
+	le->print_handler = print_handler;
+	le->print_handler_ctx = ctx;
+
+	return LINEEDIT_SET_PRINT_HANDLER_OK;
+}
+
+
+int32_t lineedit_set_prompt_callback(struct lineedit *le, int32_t (*prompt_callback)(struct lineedit *le, void *ctx), void *ctx) {
+	if (u_assert(le != NULL) ||
+	    u_assert(prompt_callback != NULL)) {
+		return LINEEDIT_SET_PROMPT_CALLBACK_FAILED;
+	}
+
+	le->prompt_callback = prompt_callback;
+	le->prompt_callback_ctx = ctx;
+	le->prompt_state = LINEEDIT_PROMPT_INVALID;
+
+	return LINEEDIT_SET_PROMPT_CALLBACK_OK;
+}
+
+
+int32_t lineedit_invalidate_prompt(struct lineedit *le) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_INVALIDATE_PROMPT_FAILED;
+	}
+
+	le->prompt_state = LINEEDIT_PROMPT_INVALID;
+
+	return LINEEDIT_INVALIDATE_PROMPT_OK;
+}
+
+
+/* Number of substitution characters prepared at once when printing
+ * a password-like line. */
+#define LINEEDIT_FILL_LEN 16
+
+/* Length of the displayed line. In the search mode it consists of the search
+ * label and the matching entry, limited by the shadow copy size. */
+static uint32_t lineedit_display_len(struct lineedit *le) {
+	if (le->search) {
+		uint32_t len = le->search_label_len + ((le->search_line != NULL) ? le->search_line_len : le->text_len);
+		if (len <= le->len) {
+			return len;
+		}
+		/* Do not display a part of the last character. */
+		len = le->len;
+		while (len > le->search_label_len) {
+			uint32_t pos = len - le->search_label_len;
+			char c = (le->search_line != NULL) ? le->search_line[pos] : lineedit_text_char(le, pos);
+			if (!LINEEDIT_UTF8_CONT(c)) {
+				break;
+			}
+			len--;
+		}
+		return len;
+	}
+	return le->text_len;
+}
+
+
+/* Position of the cursor in the displayed line. */
+static uint32_t lineedit_display_cursor(struct lineedit *le) {
+	if (le->search) {
+		uint32_t cursor = le->search_label_len + ((le->search_line != NULL) ? le->search_pos[le->search_len] : le->cursor);
+		uint32_t len = lineedit_display_len(le);
+		return (cursor < len) ? cursor : len;
+	}
+	return le->cursor;
+}
+
+
+/* Get a contiguous part of the displayed line (what should be visible after
+ * the prompt) starting at @a pos. If @a pwchar is set, @a fill prepared by
+ * the caller is returned instead of line characters. Returns its length. */
+static uint32_t lineedit_display_span(struct lineedit *le, uint32_t pos, const char **s, const char *fill) {
+	if (le->search) {
+		uint32_t len = lineedit_display_len(le);
+		if (pos < le->search_label_len) {
+			*s = le->search_label + pos;
+			return le->search_label_len - pos;
+		}
+		pos -= le->search_label_len;
+		len -= le->search_label_len;
+		if (le->search_line != NULL) {
+			*s = le->search_line + pos;
+			return len - pos;
+		}
+		return lineedit_text_span(le, pos, len, s);
+	}
+	if (le->pwchar != 0) {
+		*s = fill;
+		uint32_t n = le->text_len - pos;
+		return (n < LINEEDIT_FILL_LEN) ? n : LINEEDIT_FILL_LEN;
+	}
+	return lineedit_text_span(le, pos, le->text_len, s);
+}
+
+
+/* Check if every byte of the displayed line takes a single column. It is
+ * true for plain ASCII lines and substitution characters. */
+static uint32_t lineedit_display_ascii(struct lineedit *le) {
+	return !le->search && (le->pwchar != 0 || le->text_cols == le->text_len);
+}
+
+
+/* Column of position @a pos of the displayed line which is not plain ASCII.
+ * Widths are cached for the line start, cursor and line end, only characters
+ * between @a pos and the nearest of them are measured. */
+static uint32_t lineedit_display_col(struct lineedit *le, uint32_t pos) {
+	if (le->search) {
+		uint32_t col = 0;
+		for (uint32_t from = 0; from < pos;) {
+			const char *s;
+			uint32_t n = lineedit_display_span(le, from, &s, NULL);
+			if (n > (pos - from)) {
+				n = pos - from;
+			}
+			col += lineedit_width(s, n);
+			from += n;
+		}
+		return col;
+	}
+
+	if (pos <= le->cursor) {
+		if (pos < (le->cursor - pos)) {
+			return lineedit_text_width(le, 0, pos);
+		}
+		return le->cursor_col - lineedit_text_width(le, pos, le->cursor);
+	}
+	if ((pos - le->cursor) < (le->text_len - pos)) {
+		return le->cursor_col + lineedit_text_width(le, le->cursor, pos);
+	}
+	return le->text_cols - lineedit_text_width(le, pos, le->text_len);
+}
+
+
+/* Byte at position @a pos of the displayed line. Not usable for substitution
+ * characters. */
+static char lineedit_display_char(struct lineedit *le, uint32_t pos) {
+	const char *s;
+	lineedit_display_span(le, pos, &s, NULL);
+	return s[0];
+}
+
+
+/* Decode the character at position @a pos of the displayed line which is
+ * @a len bytes long. Returns its length. */
+static uint32_t lineedit_display_decode(struct lineedit *le, uint32_t pos, uint32_t len, uint32_t *cp) {
+	const char *s;
+	char c[4];
+	uint32_t n = lineedit_display_span(le, pos, &s, NULL);
+
+	/* The character may continue in the next span. */
+	if (n < sizeof(c) && (pos + n) < len) {
+		n = 0;
+		while (n < sizeof(c) && (pos + n) < len) {
+			c[n] = lineedit_display_char(le, pos + n);
+			n++;
+		}
+		s = c;
+	}
+
+	return lineedit_utf8_decode(s, n, cp);
+}
+
+
+/* Length of the character at position @a pos of the displayed line together
+ * with combining marks following it. Its width is returned in @a w. */
+static uint32_t lineedit_display_next(struct lineedit *le, uint32_t pos, uint32_t len, uint32_t *w) {
+	uint32_t cp;
+	uint32_t n = lineedit_display_decode(le, pos, len, &cp);
+
+	*w = lineedit_char_width(cp);
+	while ((pos + n) < len) {
+		uint32_t m = lineedit_display_decode(le, pos + n, len, &cp);
+		if (lineedit_char_width(cp) > 0) {
+			break;
+		}
+		n += m;
+	}
+
+	return n;
+}
+
+
+/* Minimal number of columns used for the line if the prompt takes (almost)
+ * the whole terminal width. */
+#define LINEEDIT_VIEW_MIN 8
+
+/* Find the end of the view. One column is left for the right overflow marker
+ * if the rest of the line does not fit into @a cols columns. */
+static void lineedit_view_end(struct lineedit *le, uint32_t len, uint32_t len_col, uint32_t cols, uint32_t ascii) {
+	/* The left overflow marker takes a column too. */
+	if (le->view > 0) {
+		cols--;
+	}
+	if ((len_col - le->view_col) <= cols) {
+		le->view_end = len;
+		return;
+	}
+	cols--;
+
+	if (ascii) {
+		le->view_end = le->view + cols;
+		return;
+	}
+	uint32_t pos = le->view;
+	uint32_t col = 0;
+	while (pos < len) {
+		uint32_t w;
+		uint32_t n = lineedit_display_next(le, pos, len, &w);
+		if ((col + w) > cols) {
+			break;
+		}
+		col += w;
+		pos += n;
+	}
+	le->view_end = pos;
+}
+
+
+/* Choose the part of the displayed line visible on the terminal if its width
+ * is known. The view is kept while the cursor stays inside it, otherwise it
+ * is scrolled to have the cursor in its middle. Only characters around the
+ * cursor are measured. */
+static void lineedit_view_update(struct lineedit *le) {
+	uint32_t len = lineedit_display_len(le);
+
+	le->view_end = len;
+	if (le->width == 0 || le->multiline) {
+		le->view = 0;
+		le->view_col = 0;
+		return;
+	}
+
+	/* The last terminal column is not used, the cursor would wrap. */
+	uint32_t cols = LINEEDIT_VIEW_MIN;
+	if (le->width > (le->prompt_len + LINEEDIT_VIEW_MIN)) {
+		cols = le->width - le->prompt_len - 1;
+	}
+	uint32_t ascii = lineedit_display_ascii(le);
+	uint32_t len_col = ascii ? len : lineedit_display_col(le, len);
+	if (len_col <= cols) {
+		le->view = 0;
+		le->view_col = 0;
+		return;
+	}
+
+	/* Text before the view may have changed since the last update. It is
+	 * measured from the cursor which is usually close. */
+	if (le->view > len) {
+		le->view = len;
+	}
+	if (ascii) {
+		le->view_col = le->view;
+	} else {
+		while (le->view > 0 && le->view < len && LINEEDIT_UTF8_CONT(lineedit_display_char(le, le->view))) {
+			le->view--;
+		}
+		le->view_col = lineedit_display_col(le, le->view);
+	}
+
+	uint32_t cursor = lineedit_display_cursor(le);
+	lineedit_view_end(le, len, len_col, cols, ascii);
+	if (cursor >= le->view && (cursor < le->view_end || le->view_end == len)) {
+		return;
+	}
+
+	/* Scroll by half of the view at least. */
+	uint32_t cursor_col = ascii ? cursor : lineedit_display_col(le, cursor);
+	uint32_t target = (cursor_col > (cols / 2)) ? (cursor_col - cols / 2) : 0;
+	if (ascii) {
+		le->view = target;
+		le->view_col = target;
+	} else {
+		uint32_t pos = cursor;
+		uint32_t col = cursor_col;
+		while (pos > 0) {
+			/* Step back over a character and marks following it. */
+			uint32_t p = pos;
+			uint32_t w;
+			do {
+				do {
+					p--;
+				} while (p > 0 && LINEEDIT_UTF8_CONT(lineedit_display_char(le, p)));
+				uint32_t cp;
+				lineedit_display_decode(le, p, len, &cp);
+				w = lineedit_char_width(cp);
+			} while (w == 0 && p > 0);
+			if ((col - w) < target) {
+				break;
+			}
+			pos = p;
+			col -= w;
+		}
+		le->view = pos;
+		le->view_col = col;
+	}
+	lineedit_view_end(le, len, len_col, cols, ascii);
+}
+
+
+/* The terminal row after the prompt shows the view of the displayed line
+ * preceded and followed by overflow markers if the line continues beyond
+ * it. Positions in the row (the screen) are used by the shadow copy. Without
+ * a view, the screen is the same as the displayed line. */
+static uint32_t lineedit_screen_len(struct lineedit *le) {
+	return (le->view > 0) + (le->view_end - le->view) + (le->view_end < lineedit_display_len(le));
+}
+
+
+static uint32_t lineedit_screen_cursor(struct lineedit *le) {
+	return (le->view > 0) + (lineedit_display_cursor(le) - le->view);
+}
+
+
+/* Get a contiguous part of the screen starting at @a pos, see
+ * lineedit_display_span. */
+static uint32_t lineedit_screen_span(struct lineedit *le, uint32_t pos, const char **s, const char *fill) {
+	uint32_t left = (le->view > 0);
+	if (pos < left) {
+		*s = "<";
+		return 1;
+	}
+	pos += le->view - left;
+	if (pos >= le->view_end) {
+		*s = ">";
+		return 1;
+	}
+	uint32_t n = lineedit_display_span(le, pos, s, fill);
+	return (n < (le->view_end - pos)) ? n : (le->view_end - pos);
+}
+
+
+/* Column of position @a pos of the screen which is not plain ASCII. */
+static uint32_t lineedit_screen_col(struct lineedit *le, uint32_t pos) {
+	uint32_t left = (le->view > 0);
+	if (pos <= left) {
+		return pos;
+	}
+	pos += le->view - left;
+	if (pos > le->view_end) {
+		return left + lineedit_display_col(le, le->view_end) - le->view_col + 1;
+	}
+	return left + lineedit_display_col(le, pos) - le->view_col;
+}
+
+
+/* Back position @a pos off to a character boundary of both the screen and
+ * the terminal contents, which are the same before @a pos. A character
+ * followed by combining marks is redrawn together with them. */
+static uint32_t lineedit_screen_boundary(struct lineedit *le, uint32_t pos, const char *fill) {
+	uint32_t len = lineedit_screen_len(le);
+
+	while (pos > 0) {
+		uint32_t back = 0;
+		if (pos < le->shadow_len) {
+			back = lineedit_utf8_joins(le->shadow + pos, le->shadow_len - pos);
+		}
+		if (!back && pos < len) {
+			const char *s;
+			uint32_t n = lineedit_screen_span(le, pos, &s, fill);
+			back = lineedit_utf8_joins(s, n);
+		}
+		if (!back) {
+			break;
+		}
+		do {
+			pos--;
+		} while (pos > 0 && LINEEDIT_UTF8_CONT(le->shadow[pos]));
+	}
+
+	return pos;
+}
+
+
+/* Print the screen from position @a from up to @a to (excluding) and save it
+ * to the shadow copy of the terminal contents. */
+static void lineedit_print_screen(struct lineedit *le, uint32_t from, uint32_t to) {
+	char fill[LINEEDIT_FILL_LEN];
+	memset(fill, le->pwchar, sizeof(fill));
+
+	while (from < to) {
+		const char *s;
+		uint32_t n = lineedit_screen_span(le, from, &s, fill);
+		if (n > (to - from)) {
+			n = to - from;
+		}
+		lineedit_write(le, s, n);
+		memcpy(le->shadow + from, s, n);
+		from += n;
+	}
+}
+
+
+/* Length of an escape sequence with numeric parameter @a n. Parameter 1 is
+ * the default one and it is omitted. */
+static uint32_t lineedit_escape_len(uint32_t n) {
+	uint32_t len = 3;
+	if (n > 1) {
+		for (; n > 0; n /= 10) {
+			len++;
+		}
+	}
+	return len;
+}
+
+
+/* Ways of moving the terminal cursor, see lineedit_move_plan. */
+enum lineedit_move {
+	MOVE_NONE, MOVE_RELATIVE, MOVE_COLUMN, MOVE_CR, MOVE_CR_RELATIVE
+};
+
+
+/* Choose the shortest way of moving the terminal cursor from column
+ * @a from to column @a to of the terminal row (including the prompt).
+ * Cursor can be moved relatively, to an absolute column or to the row start
+ * and then right. Number of bytes needed is returned in @a cost. */
+static enum lineedit_move lineedit_move_plan(uint32_t from, uint32_t to, uint32_t *cost) {
+	if (from == to) {
+		*cost = 0;
+		return MOVE_NONE;
+	}
+
+	enum lineedit_move move = MOVE_RELATIVE;
+	*cost = lineedit_escape_len((from < to) ? (to - from) : (from - to));
+
+	uint32_t c = lineedit_escape_len(to + 1);
+	if (c < *cost) {
+		move = MOVE_COLUMN;
+		*cost = c;
+	}
+	c = 1 + ((to > 0) ? lineedit_escape_len(to) : 0);
+	if (c < *cost) {
+		move = (to > 0) ? MOVE_CR_RELATIVE : MOVE_CR;
+		*cost = c;
+	}
+
+	return move;
+}
+
+
+/* Move terminal cursor from column @a from to column @a to of the
+ * terminal row using the shortest escape sequence. */
+static void lineedit_move_cursor(struct lineedit *le, uint32_t from, uint32_t to) {
+	uint32_t cost;
+
+	switch (lineedit_move_plan(from, to, &cost)) {
+		case MOVE_RELATIVE:
+			if (from < to) {
+				lineedit_escape_print(le, ESC_CURSOR_RIGHT, to - from);
+			} else {
+				lineedit_escape_print(le, ESC_CURSOR_LEFT, from - to);
+			}
+			break;
+		case MOVE_COLUMN:
+			lineedit_escape_print(le, ESC_CURSOR_COLUMN, to + 1);
+			break;
+		case MOVE_CR_RELATIVE:
+			lineedit_write(le, "\r", 1);
+			lineedit_escape_print(le, ESC_CURSOR_RIGHT, to);
+			break;
+		case MOVE_CR:
+			lineedit_write(le, "\r", 1);
+			break;
+		default:
+			break;
+	}
+}
+
+
+/* Print the screen from position @a from to its end. Terminal cursor is then
+ * moved to the edit cursor, saving its position on the way if it is cheaper
+ * than moving back. */
+static void lineedit_print_tail(struct lineedit *le, uint32_t from) {
+	uint32_t len = lineedit_screen_len(le);
+	uint32_t cursor = lineedit_screen_cursor(le);
+	uint32_t len_col = len;
+	uint32_t cursor_col = cursor;
+	uint32_t saved = 0;
+	if (!lineedit_display_ascii(le)) {
+		len_col = lineedit_screen_col(le, len);
+		cursor_col = lineedit_screen_col(le, cursor);
+	}
+
+	/* Cursor save and restore sequences are 6 bytes together. */
+	uint32_t cost;
+	lineedit_move_plan(le->prompt_len + len_col, le->prompt_len + cursor_col, &cost);
+	if (cursor >= from && cost > 6) {
+		lineedit_print_screen(le, from, cursor);
+		lineedit_escape_print(le, ESC_CURSOR_SAVE, 0);
+		saved = 1;
+		from = cursor;
 	}
+	lineedit_print_screen(le, from, len);
 
-	if ((recall_index >= (int32_t)le->history_size) || (recall_index < -1)) {
-		return LINEEDIT_HISTORY_RECALL_FAILED;
+	/* erase remains of the previous line */
+	if (le->shadow_cols > len_col) {
+		lineedit_escape_print(le, ESC_ERASE_LINE_END, 0);
+		le->hint_cols = 0;
 	}
+	le->shadow_len = len;
+	le->shadow_cols = len_col;
 
-	if (recall_index == -1) {
-		*line = "";
+	if (saved) {
+		lineedit_escape_print(le, ESC_CURSOR_RESTORE, 0);
 	} else {
-		*line = le->history + (recall_index * le->len);
+		lineedit_move_cursor(le, le->prompt_len + len_col, le->prompt_len + cursor_col);
 	}
-	return LINEEDIT_HISTORY_RECALL_OK;
+	le->shadow_cursor = cursor;
+	le->shadow_cursor_col = cursor_col;
 }
 
 
-int32_t lineedit_keypress(struct lineedit *le, int c) {
-	if (u_assert(le != NULL)) {
-		return LINEEDIT_FAILED;
+/* In the multi-line mode, the displayed line is split to terminal rows at
+ * newlines. Terminal columns (including the prompt) are used instead of
+ * columns of the displayed line. Positions of the shadow copy are converted
+ * to rows and columns by looking at the shadow copy only, unchanged rows
+ * above an edit need not be measured. */
+
+/* Column of position @a pos of the shadow copy. If @a ascii is set, the
+ * row contents are known to be plain ASCII. */
+static uint32_t lineedit_rows_col(struct lineedit *le, uint32_t pos, uint32_t ascii) {
+	uint32_t start = pos;
+	while (start > 0 && le->shadow[start - 1] != '\n') {
+		start--;
 	}
 
-	if (le->escape == ESC_NONE) {
+	uint32_t col = (start > 0) ? le->cont_prompt_width : le->prompt_len;
+	return col + (ascii ? (pos - start) : lineedit_width(le->shadow + start, pos - start));
+}
 
-		switch (c) {
-			/* check for TAB */
-			case 0x09:
-				return LINEEDIT_TAB;
 
-			/* check for line feed */
-			case 0x0a:
-			case 0x0b:
-			case 0x0c:
-			case 0x0d:
-				/* save current line to the history and reset recall
-				 * index to point to the current line (-1) */
-				lineedit_history_append(le, le->text);
-				le->recall_index = -1;
-				return LINEEDIT_ENTER;
+/* Number of newlines between positions @a from and @a to of the shadow
+ * copy. */
+static uint32_t lineedit_rows_count(struct lineedit *le, uint32_t from, uint32_t to) {
+	uint32_t rows = 0;
 
-			case 0x12:
-				lineedit_refresh(le);
-				break;
+	while (from < to) {
+		const char *nl = memchr(le->shadow + from, '\n', to - from);
+		if (nl == NULL) {
+			break;
+		}
+		rows++;
+		from = nl - le->shadow + 1;
+	}
 
-			/* interrupt escape sequence */
-			case 0x18:
-			case 0x1a:
-				le->escape = ESC_NONE;
-				break;
+	return rows;
+}
 
-			/* check for ESC */
-			case 0x1b:
-				le->escape = ESC_ESC;
-				break;
 
-			/* check for DEL (backspace) */
-			case 0x7f:
-				/* Do not check return value, if we are unable to do backspace,
-				 * we just ignore it. */
-				lineedit_backspace(le);
-				break;
+/* Move terminal cursor to position @a pos of the shadow copy at column
+ * @a col using relative movements. */
+static void lineedit_rows_move(struct lineedit *le, uint32_t pos, uint32_t col) {
+	if (pos < le->shadow_cursor) {
+		uint32_t rows = lineedit_rows_count(le, pos, le->shadow_cursor);
+		if (rows > 0) {
+			lineedit_escape_print(le, ESC_CURSOR_UP, rows);
+			le->shadow_row -= rows;
+		}
+	} else {
+		uint32_t rows = lineedit_rows_count(le, le->shadow_cursor, pos);
+		if (rows > 0) {
+			lineedit_escape_print(le, ESC_CURSOR_DOWN, rows);
+			le->shadow_row += rows;
+		}
+	}
+	lineedit_move_cursor(le, le->shadow_cursor_col, col);
+	le->shadow_cursor = pos;
+	le->shadow_cursor_col = col;
+}
 
-			/* check for CSI */
-			case 0x9b:
-				le->escape = ESC_CSI;
-				le->csi_escape_mod = 0;
-				break;
 
-			default:
-				/* other alphanumeric characters */
-				if (c >= 32 && c <= 126) {
-					/* Do not check return value, if we are unable to insert it,
-					 * we just ignore the character. */
-					lineedit_insert_char(le, c);
-				}
-				break;
-		}
+/* Print the displayed line from position @a from, where the terminal cursor
+ * is, to its end. All rows below are printed again. Terminal cursor is then
+ * moved to the edit cursor. */
+static void lineedit_rows_print(struct lineedit *le, uint32_t from, uint32_t ascii) {
+	char fill[LINEEDIT_FILL_LEN];
+	memset(fill, le->pwchar, sizeof(fill));
+	uint32_t len = lineedit_display_len(le);
 
-	} else if (le->escape == ESC_ESC) {
+	/* erase remains of the previous line */
+	if (from < le->shadow_len) {
+		lineedit_escape_print(le, ESC_ERASE_SCREEN_END, 0);
+	}
 
-		/* if ESC is set and '[' character was received, start CSI sequence */
-		if (c == '[') {
-			le->escape = ESC_CSI;
-			le->csi_escape_mod = 0;
+	while (from < len) {
+		const char *s;
+		uint32_t n = lineedit_display_span(le, from, &s, fill);
+		const char *nl = memchr(s, '\n', n);
+		if (nl != NULL) {
+			n = nl - s;
 		}
-
-		/* if ESC is set and ']' character was received, start OSC sequence */
-		if (c == ']') {
-			le->escape = ESC_OSC;
+		lineedit_write(le, s, n);
+		memcpy(le->shadow + from, s, n);
+		from += n;
+
+		if (nl != NULL) {
+			lineedit_write(le, "\r\n", 2);
+			lineedit_write(le, le->cont_prompt, le->cont_prompt_len);
+			le->shadow[from++] = '\n';
+			le->shadow_row++;
 		}
+	}
+	le->shadow_len = len;
+	le->shadow_cols = ascii ? len : lineedit_display_col(le, len);
+	le->shadow_cursor = len;
+	le->shadow_cursor_col = lineedit_rows_col(le, len, ascii);
 
-	} else if (le->escape == ESC_CSI) {
+	uint32_t cursor = lineedit_display_cursor(le);
+	lineedit_rows_move(le, cursor, lineedit_rows_col(le, cursor, ascii));
+}
 
-		/* if CSI is set, try to read first alphanumeric character (parameters are ignored) */
-		switch (c) {
-			/* Escape modifier, we continue with CSI escape flag set. */
-			case '0':
-			case '1':
-			case '2':
-			case '3':
-			case '4':
-			case '5':
-			case '6':
-			case '7':
-			case '8':
-			case '9':
-				le->csi_escape_mod = le->csi_escape_mod * 10 + (c - '0');
-				break;
 
-			case 'A': {
-				/* Move cursor up (previous history entry). */
-				char *hist_command;
-				if (lineedit_history_recall(le, &hist_command, le->recall_index + 1) == LINEEDIT_HISTORY_RECALL_OK) {
-					lineedit_set_line(le, hist_command);
-					lineedit_refresh(le);
-					le->recall_index++;
-				}
-				break;
-			}
+/* Print the prompt by the prompt callback and cache its output. The width
+ * is measured from the output, the value returned by the callback is used
+ * only if nothing was printed through lineedit (or on error). */
+static void lineedit_prompt_render(struct lineedit *le) {
+	le->prompt_state = LINEEDIT_PROMPT_RENDERING;
+	le->prompt_cache_len = 0;
+	int32_t ret = le->prompt_callback(le, le->prompt_callback_ctx);
 
-			case 'B': {
-				/* Move cursor down (next history entry). */
-				char *hist_command;
-				if (lineedit_history_recall(le, &hist_command, le->recall_index - 1) == LINEEDIT_HISTORY_RECALL_OK) {
-					lineedit_set_line(le, hist_command);
-					lineedit_refresh(le);
-					le->recall_index--;
-				}
-				break;
-			}
+	/* negative number returned, error occured */
+	if (ret < 0) {
+		le->prompt_state = LINEEDIT_PROMPT_INVALID;
+		le->prompt_len = 0;
+		return;
+	}
+	le->prompt_len = ret;
+	if (le->prompt_state != LINEEDIT_PROMPT_RENDERING || le->prompt_cache_len == 0) {
+		le->prompt_state = LINEEDIT_PROMPT_INVALID;
+		return;
+	}
 
-			case 'C':
-				/* move cursor right */
-				if (le->cursor < (strlen(le->text))) {
-					le->cursor++;
-					lineedit_escape_print(le, ESC_CURSOR_RIGHT, 1);
-				}
-				break;
+	le->prompt_cache_width = lineedit_output_width(le->prompt_cache, le->prompt_cache_len);
+	le->prompt_len = le->prompt_cache_width;
+	le->prompt_state = LINEEDIT_PROMPT_CACHED;
+}
 
-			case 'D':
-				/* move cursor left */
-				if (le->cursor > 0) {
-					le->cursor--;
-					lineedit_escape_print(le, ESC_CURSOR_LEFT, 1);
-				}
-				break;
 
-			case '~':
-				/* Delete key. */
-				lineedit_backspace(le);
-				break;
+/* Suggestions are displayed after a single row line which is not scrolled,
+ * only if the line is visible as it is. */
+static uint32_t lineedit_hint_enabled(struct lineedit *le) {
+	return le->hint_index != NULL && le->shared_history == NULL &&
+	       !le->multiline && !le->search && !le->pwchar && !le->paste &&
+	       le->view == 0 && le->view_end == le->text_len;
+}
 
-			default:
-				break;
 
+/* Display the suggestion for the line after it was printed. Before that,
+ * the line took @a old_cols columns, followed by the displayed suggestion
+ * (unless it was erased meanwhile). Only the part of the suggestion which
+ * changed is printed. */
+static void lineedit_hint_update(struct lineedit *le, uint32_t old_cols) {
+	struct lineedit_ring *r = &le->history;
+	uint32_t w;
+
+	/* Part of the displayed suggestion not overwritten by the line, or
+	 * just the number of columns taken by it if its contents are not
+	 * known. */
+	const char *shown = NULL;
+	uint32_t shown_len = 0;
+	uint32_t shown_cols = 0;
+	if (le->hint_cols > 0 && (old_cols + le->hint_cols) > le->shadow_cols) {
+		shown_cols = old_cols + le->hint_cols - le->shadow_cols;
+		if (le->shadow_cols >= old_cols && lineedit_hint_present(le, le->hint_seq)) {
+			shown = (const char *)lineedit_ring_payload(r, le->hint_off) + le->hint_start;
+			shown_len = le->hint_end - le->hint_start;
+			/* Marks following an overwritten character are gone
+			 * with it. */
+			uint32_t skip = le->shadow_cols - old_cols;
+			if (skip > 0) {
+				while (shown_len > 0) {
+					uint32_t n = lineedit_hint_char(le, shown, shown_len, &w);
+					if (n == 0 || w > skip || (skip == 0 && w > 0)) {
+						break;
+					}
+					skip -= w;
+					shown += n;
+					shown_len -= n;
+				}
+			}
+			if (skip > 0) {
+				shown = NULL;
+			}
 		}
+	}
 
-		le->escape = ESC_NONE;
+	/* The new suggestion, as much as fits the terminal row. It is not
+	 * displayed if it starts with a mark, it would combine with the last
+	 * character of the line already displayed. */
+	const char *hint = NULL;
+	uint32_t hint_len = 0;
+	uint32_t hint_cols = 0;
+	uint32_t seq = lineedit_hint_none(le);
+	uint32_t off = 0;
+	if (lineedit_hint_enabled(le) && lineedit_hint_find(le, &seq, &off) == 0) {
+		uint32_t width = (le->width > 0) ? le->width : LINEEDIT_TERMINAL_WIDTH;
+		uint32_t used = le->prompt_len + le->shadow_cols + 1;
+		uint32_t avail = (width > used) ? (width - used) : 0;
+		uint32_t len = lineedit_history_len(r, off) - le->text_len;
+		hint = (const char *)lineedit_ring_payload(r, off) + le->text_len;
+		while (hint_len < len) {
+			uint32_t n = lineedit_hint_char(le, hint + hint_len, len - hint_len, &w);
+			if (n == 0 || (hint_len == 0 && w == 0) || (hint_cols + w) > avail) {
+				break;
+			}
+			hint_len += n;
+			hint_cols += w;
+		}
+	}
 
-	} else if (le->escape == ESC_OSC) {
+	/* Characters already displayed are skipped. */
+	uint32_t same = 0;
+	uint32_t same_cols = 0;
+	if (shown != NULL) {
+		while (same < hint_len && same < shown_len) {
+			uint32_t n = lineedit_hint_char(le, hint + same, hint_len - same, &w);
+			if (n == 0 || (same + n) > shown_len || memcmp(hint + same, shown + same, n)) {
+				break;
+			}
+			same += n;
+			same_cols += w;
+		}
+	}
 
-		le->escape = ESC_NONE;
+	if (same < hint_len || shown_cols > hint_cols) {
+		uint32_t col = le->prompt_len + le->shadow_cols;
+		uint32_t cursor_col = le->prompt_len + le->shadow_cursor_col;
+		lineedit_move_cursor(le, cursor_col, col + same_cols);
+		if (same < hint_len) {
+			lineedit_escape_print(le, ESC_COLOR, LINEEDIT_HINT_COLOR);
+			lineedit_write(le, hint + same, hint_len - same);
+			lineedit_escape_print(le, ESC_DEFAULT, 0);
+		}
+		if (shown_cols > hint_cols) {
+			lineedit_escape_print(le, ESC_ERASE_LINE_END, 0);
+		}
+		lineedit_move_cursor(le, col + hint_cols, cursor_col);
 	}
 
-	return LINEEDIT_OK;
+	le->hint_seq = seq;
+	le->hint_off = off;
+	le->hint_start = le->text_len;
+	le->hint_end = le->text_len + hint_len;
+	le->hint_cols = hint_cols;
 }
 
 
-int32_t lineedit_backspace(struct lineedit *le) {
+int32_t lineedit_refresh(struct lineedit *le) {
 	if (u_assert(le != NULL)) {
-		return LINEEDIT_BACKSPACE_FAILED;
+		return LINEEDIT_REFRESH_FAILED;
 	}
-
-	/* we are going to remove 1 character at cursor position,
-	 * check if we have anything to remove */
-	if (strlen(le->text) == 0 || le->cursor == 0) {
-		return LINEEDIT_BACKSPACE_FAILED;
+	le->line_hidden = 0;
+
+	/* The whole line is redrawn when the output is resumed. */
+	if (le->out_blocked) {
+		LINEEDIT_STAT_ADD(le, deferred, 1);
+		le->shadow_valid = 0;
+		le->redraw_pending = 1;
+		return LINEEDIT_REFRESH_OK;
 	}
 
-	/* move cursor left */
-	le->cursor--;
-	lineedit_escape_print(le, ESC_CURSOR_LEFT, 1);
+	LINEEDIT_STAT_ADD(le, refreshes, 1);
+	lineedit_output_hold(le);
 
-	/* shift line left */
-	int32_t i = le->cursor;
-	while (le->text[i] != 0) {
-		le->text[i] = le->text[i + 1];
-		i++;
+	/* The terminal contents are known again after the refresh, unless some
+	 * output is dropped meanwhile. */
+	le->shadow_valid = 1;
+
+	/* move cursor to start */
+	lineedit_print(le, "\r");
+	if (le->shadow_row > 0) {
+		lineedit_escape_print(le, ESC_CURSOR_UP, le->shadow_row);
 	}
 
-	/* save cursor position */
-	lineedit_escape_print(le, ESC_CURSOR_SAVE, 0);
+	/* erase whole line (and rows below it in the multi-line mode) */
+	if (le->multiline || le->shadow_row > 0) {
+		lineedit_escape_print(le, ESC_ERASE_SCREEN_END, 0);
+	} else {
+		lineedit_escape_print(le, ESC_ERASE_LINE_END, 0);
+	}
+	le->shadow_row = 0;
+	le->hint_cols = 0;
 
-	/* now we need to refresh rest of the line */
-	i = le->cursor;
-	while (le->text[i]) {
-		char line[2] = {le->text[i], '\0'};
-		lineedit_print(le, line);
-		i++;
+	/* Bracketed paste mode needs to be enabled once, but the terminal may
+	 * have been reset since. */
+	if (le->paste_mode) {
+		lineedit_escape_print(le, ESC_BRACKETED_PASTE, 1);
 	}
 
-	/* erase everything to the end of current line */
-	lineedit_escape_print(le, ESC_ERASE_LINE_END, 0);
+	/* The search label is displayed instead of the prompt. */
+	if (le->search) {
+		le->prompt_len = 0;
+	} else if (le->prompt_state == LINEEDIT_PROMPT_CACHED) {
+		lineedit_write(le, le->prompt_cache, le->prompt_cache_len);
+		le->prompt_len = le->prompt_cache_width;
+	} else if (le->prompt_callback != NULL) {
+		lineedit_prompt_render(le);
+	}
+
+	/* print the whole line */
+	le->shadow_len = 0;
+	le->shadow_cols = 0;
+	lineedit_view_update(le);
+	if (le->multiline) {
+		le->shadow_cursor = 0;
+		le->shadow_cursor_col = le->prompt_len;
+		lineedit_rows_print(le, 0, lineedit_display_ascii(le));
+	} else {
+		lineedit_print_tail(le, 0);
+		lineedit_hint_update(le, le->shadow_cols);
+	}
 
-	/* restore cursor position */
-	lineedit_escape_print(le, ESC_CURSOR_RESTORE, 0);
+	lineedit_output_release(le);
 
-	return LINEEDIT_BACKSPACE_OK;
+	return LINEEDIT_REFRESH_OK;
 }
 
 
-int32_t lineedit_insert_char(struct lineedit *le, int c) {
+int32_t lineedit_update(struct lineedit *le) {
 	if (u_assert(le != NULL)) {
-		return LINEEDIT_INSERT_CHAR_FAILED;
+		return LINEEDIT_UPDATE_FAILED;
 	}
 
-	/* Only printable characters can be inserted. */
-	if (c < 32 || c > 127) {
-		return LINEEDIT_INSERT_CHAR_FAILED;
+	if (!le->shadow_valid) {
+		return (lineedit_refresh(le) == LINEEDIT_REFRESH_OK) ? LINEEDIT_UPDATE_OK : LINEEDIT_UPDATE_FAILED;
 	}
 
-	/* we are going to insert 1 character, check if we have enough space */
-	if ((le->len - strlen(le->text) - 1) <= 0) {
-		return LINEEDIT_INSERT_CHAR_FAILED;;
+	/* Redraw once the output is resumed. Terminal contents are compared
+	 * again at that time, intermediate states are never printed. */
+	if (le->out_blocked) {
+		LINEEDIT_STAT_ADD(le, deferred, 1);
+		le->redraw_pending = 1;
+		return LINEEDIT_UPDATE_OK;
 	}
 
-	int32_t i = strlen(le->text);
-	while (i >= (int32_t)le->cursor) {
-		le->text[i + 1] = le->text[i];
-		i--;
+	LINEEDIT_STAT_ADD(le, updates, 1);
+	lineedit_output_hold(le);
+	uint32_t old_cols = le->shadow_cols;
+
+	/* Find the longest common prefix of the screen and the terminal
+	 * contents. */
+	char fill[LINEEDIT_FILL_LEN];
+	memset(fill, le->pwchar, sizeof(fill));
+	lineedit_view_update(le);
+	uint32_t len = lineedit_screen_len(le);
+	uint32_t cursor = lineedit_screen_cursor(le);
+	uint32_t max = (len < le->shadow_len) ? len : le->shadow_len;
+	uint32_t same = 0;
+	while (same < max) {
+		const char *s;
+		uint32_t n = lineedit_screen_span(le, same, &s, fill);
+		if (n > (max - same)) {
+			n = max - same;
+		}
+		if (memcmp(s, le->shadow + same, n)) {
+			while (s[0] == le->shadow[same]) {
+				s++;
+				same++;
+			}
+			break;
+		}
+		same += n;
 	}
 
-	/* set character at cursor */
-	le->text[le->cursor] = c;
-
-	/* and increment cursor */
-	le->cursor++;
-
-	/* print character at cursor position */
-	char line[2] = {(le->pwchar != 0) ? le->pwchar : c, '\0'};
-	lineedit_print(le, line);
-
-	/* save cursor position */
-	lineedit_escape_print(le, ESC_CURSOR_SAVE, 0);
-
-	/* now we need to refresh rest of the line */
-	i = le->cursor;
-	while (le->text[i]) {
-		char line[2] = {(le->pwchar != 0) ? le->pwchar : le->text[i], '\0'};
-		lineedit_print(le, line);
-		i++;
+	uint32_t ascii = lineedit_display_ascii(le);
+	if (same < len || same < le->shadow_len) {
+		/* Redraw everything from the first difference. Both lines are
+		 * plain ASCII most of the time, characters need not be checked. */
+		uint32_t col = same;
+		if (!ascii || le->shadow_cols != le->shadow_len) {
+			same = lineedit_screen_boundary(le, same, fill);
+			col = le->multiline ? 0 : lineedit_screen_col(le, same);
+
+			/* Combining marks at the line start are displayed over the
+			 * prompt, it needs to be redrawn too. */
+			if (same == 0 && le->shadow_len > 0 && lineedit_utf8_joins(le->shadow, le->shadow_len)) {
+				lineedit_output_release(le);
+				return (lineedit_refresh(le) == LINEEDIT_REFRESH_OK) ? LINEEDIT_UPDATE_OK : LINEEDIT_UPDATE_FAILED;
+			}
+		}
+		if (le->multiline) {
+			/* Rows above the first difference are kept. */
+			lineedit_rows_move(le, same, lineedit_rows_col(le, same, ascii));
+			lineedit_rows_print(le, same, ascii);
+		} else {
+			lineedit_move_cursor(le, le->prompt_len + le->shadow_cursor_col, le->prompt_len + col);
+			lineedit_print_tail(le, same);
+			lineedit_hint_update(le, old_cols);
+		}
+	} else if (le->multiline) {
+		lineedit_rows_move(le, cursor, lineedit_rows_col(le, cursor, ascii));
+	} else {
+		/* Contents are the same, only the cursor moved. */
+		uint32_t col = ascii ? cursor : lineedit_screen_col(le, cursor);
+		lineedit_move_cursor(le, le->prompt_len + le->shadow_cursor_col, le->prompt_len + col);
+		le->shadow_cursor = cursor;
+		le->shadow_cursor_col = col;
+		lineedit_hint_update(le, old_cols);
 	}
 
-	/* restore cursor position */
-	lineedit_escape_print(le, ESC_CURSOR_RESTORE, 0);
+	lineedit_output_release(le);
 
-	return LINEEDIT_INSERT_CHAR_OK;
+	return LINEEDIT_UPDATE_OK;
 }
 
 
-int32_t lineedit_set_print_handler(struct lineedit *le, int32_t (*print_handler)(const char *line, void *ctx), void *ctx) {
+int32_t lineedit_set_paste_mode(struct lineedit *le, uint32_t enable, uint32_t newline) {
 	if (u_assert(le != NULL) ||
-	    u_assert(print_handler != NULL)) {
-		return LINEEDIT_SET_PRINT_HANDLER_FAILED;
+	    u_assert(newline <= LINEEDIT_PASTE_NEWLINE_KEEP)) {
+		return LINEEDIT_SET_PASTE_MODE_FAILED;
 	}
 
-	le->print_handler = print_handler;
-	le->print_handler_ctx = ctx;
+	/* Bracketed paste is enabled on the next refresh, disable it now. */
+	if (le->paste_mode && !enable) {
+		lineedit_escape_print(le, ESC_BRACKETED_PASTE, 0);
+	}
+	le->paste_mode = enable;
+	le->paste_newline = newline;
 
-	return LINEEDIT_SET_PRINT_HANDLER_OK;
+	return LINEEDIT_SET_PASTE_MODE_OK;
 }
 
 
-int32_t lineedit_set_prompt_callback(struct lineedit *le, int32_t (*prompt_callback)(struct lineedit *le, void *ctx), void *ctx) {
-	if (u_assert(le != NULL) ||
-	    u_assert(prompt_callback != NULL)) {
-		return LINEEDIT_SET_PROMPT_CALLBACK_FAILED;
+int32_t lineedit_set_utf8(struct lineedit *le, uint32_t enable) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_SET_UTF8_FAILED;
 	}
 
-	le->prompt_callback = prompt_callback;
-	le->prompt_callback_ctx = ctx;
+	le->utf8 = enable;
+	le->utf8_len = 0;
 
-	return LINEEDIT_SET_PROMPT_CALLBACK_OK;
+	return LINEEDIT_SET_UTF8_OK;
 }
 
 
-int32_t lineedit_refresh(struct lineedit *le) {
+int32_t lineedit_set_width(struct lineedit *le, uint32_t width) {
 	if (u_assert(le != NULL)) {
-		return LINEEDIT_REFRESH_FAILED;
+		return LINEEDIT_SET_WIDTH_FAILED;
 	}
 
-	uint32_t saved = 0;
-
-	/* move cursor to start */
-	lineedit_print(le, "\r");
-
-	/* erase whole line */
-	lineedit_escape_print(le, ESC_ERASE_LINE_END, 0);
-
-	if (le->prompt_callback != NULL) {
-		le->prompt_len = le->prompt_callback(le, le->prompt_callback_ctx);
-		/* negative number returned, error occured */
-		if (le->prompt_len < 0) {
-			le->prompt_len = 0;
-		}
-	}
+	le->width = width;
 
-	uint32_t i = 0;
-	while (le->text[i] != '\0') {
-		if (le->cursor == i) {
-			/* save cursor position */
-			lineedit_escape_print(le, ESC_CURSOR_SAVE, 0);
-			saved = 1;
-		}
+	return LINEEDIT_SET_WIDTH_OK;
+}
 
-		char line[2] = {le->text[i], '\0'};
-		lineedit_print(le, line);
 
-		i++;
+int32_t lineedit_set_multiline(struct lineedit *le, uint32_t enable, const char *cont_prompt) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_SET_MULTILINE_FAILED;
 	}
 
-	/* restore cursor position if needed */
-	if (saved) {
-		lineedit_escape_print(le, ESC_CURSOR_RESTORE, 0);
+	if (cont_prompt == NULL) {
+		cont_prompt = "";
 	}
+	le->multiline = enable;
+	le->cont_prompt = cont_prompt;
+	le->cont_prompt_len = strlen(cont_prompt);
+	le->cont_prompt_width = lineedit_width(cont_prompt, le->cont_prompt_len);
 
-	return LINEEDIT_REFRESH_OK;
+	return LINEEDIT_SET_MULTILINE_OK;
 }
 
 
@@ -491,25 +4096,24 @@ int32_t lineedit_get_cursor(struct lineedit *le, uint32_t *cursor) {
 }
 
 
-/* TODO: can be implemented more effectively. */
 int32_t lineedit_set_cursor(struct lineedit *le, uint32_t cursor) {
 	if (u_assert(le != NULL)) {
 		return LINEEDIT_SET_CURSOR_FAILED;
 	}
 
-	if (cursor > strlen(le->text)) {
+	if (cursor > le->text_len) {
 		return LINEEDIT_SET_CURSOR_FAILED;
 	}
 
-	le->cursor = cursor;
-
-	/* move cursor to start */
-	lineedit_print(le, "\r");
-
-	/* Move cursor to the right up to requested cursor position. */
-	for (uint32_t i = 0; i < le->cursor; i++) {
-		lineedit_escape_print(le, ESC_CURSOR_RIGHT, 0);
+	/* Keep the cursor at a character boundary. */
+	while (cursor > 0 && cursor < le->text_len && LINEEDIT_UTF8_CONT(lineedit_text_char(le, cursor))) {
+		cursor--;
 	}
+	lineedit_cursor_move(le, cursor);
+	lineedit_update(le);
+
+	/* Typing elsewhere starts a new undo step. */
+	le->undo_merge = 0;
 
 	return LINEEDIT_SET_CURSOR_OK;
 
@@ -522,6 +4126,10 @@ int32_t lineedit_get_line(struct lineedit *le, char **text) {
 		return LINEEDIT_GET_LINE_FAILED;
 	}
 
+	/* Make the line contiguous by moving the gap to its end. There is
+	 * always at least one byte of gap left for the terminator. */
+	lineedit_gap_move(le, le->text_len);
+	le->text[le->text_len] = '\0';
 	*text = le->text;
 
 	return LINEEDIT_GET_LINE_OK;
@@ -534,9 +4142,45 @@ int32_t lineedit_set_line(struct lineedit *le, const char *text) {
 		return LINEEDIT_SET_LINE_FAILED;
 	}
 
-	strncpy(le->text, text, le->len);
-	le->text[le->len - 1] = 0;
-	le->cursor = strlen(le->text);
+	uint32_t text_len = strlen(text);
+	if (text_len > (le->len - 1)) {
+		text_len = le->len - 1;
+		while (text_len > 0 && LINEEDIT_UTF8_CONT(text[text_len])) {
+			text_len--;
+		}
+	}
+
+	/* Replacing the line is a single undo step. If the line is replaced
+	 * again (stepping through the history), only the last replacement is
+	 * kept. */
+	struct lineedit_ring *r = &le->undo;
+	uint32_t join = 0;
+	uint32_t off = (le->undo_done > 0) ? lineedit_ring_older(r, le->undo_pos) : 0;
+	if (le->undo_merge == LINEEDIT_UNDO_MERGE_LINE && le->undo_done > 0 &&
+	    (lineedit_undo_type(r, off) & ~LINEEDIT_UNDO_JOIN) == LINEEDIT_UNDO_INSERT) {
+		join = lineedit_undo_type(r, off) & LINEEDIT_UNDO_JOIN;
+		r->head = off;
+		r->count = --le->undo_done;
+		le->undo_pos = off;
+	} else if (le->undo_merge == LINEEDIT_UNDO_MERGE_LINE && le->undo_done > 0) {
+		/* The line was replaced by an empty one. */
+		join = LINEEDIT_UNDO_JOIN;
+	} else if (le->text_len > 0) {
+		lineedit_undo_log(le, LINEEDIT_UNDO_DELETE, 0, NULL, le->text_len, 0);
+		join = LINEEDIT_UNDO_JOIN;
+	}
+	lineedit_undo_log(le, LINEEDIT_UNDO_INSERT | join, 0, text, text_len, 0);
+	le->undo_merge = LINEEDIT_UNDO_MERGE_LINE;
+
+	memcpy(le->text, text, text_len);
+	le->text_len = text_len;
+	le->gap_start = text_len;
+	le->gap_end = le->len;
+	le->cursor = text_len;
+	le->text_cols = lineedit_width(text, text_len);
+	le->cursor_col = le->text_cols;
+	le->view = 0;
+	le->view_col = 0;
 
 	return LINEEDIT_SET_LINE_OK;
 }
@@ -547,8 +4191,15 @@ int32_t lineedit_clear(struct lineedit *le) {
 		return LINEEDIT_CLEAR_FAILED;
 	}
 
-	le->text[0] = '\0';
+	le->text_len = 0;
+	le->gap_start = 0;
+	le->gap_end = le->len;
 	le->cursor = 0;
+	le->text_cols = 0;
+	le->cursor_col = 0;
+	le->view = 0;
+	le->view_col = 0;
+	lineedit_undo_reset(le);
 
 	return LINEEDIT_CLEAR_OK;
 }
@@ -560,14 +4211,352 @@ int32_t lineedit_insert(struct lineedit *le, const char *text) {
 		return LINEEDIT_INSERT_FAILED;
 	}
 
-	while (*text) {
-		lineedit_insert_char(le, *text);
-		text++;
+	/* Non-printable characters are skipped, newlines are kept in the
+	 * multi-line mode. */
+	lineedit_output_hold(le);
+	uint32_t len = strlen(text);
+	while (len > 0) {
+		uint32_t run = lineedit_printable_run(text, len);
+		if (run > 0) {
+			lineedit_insert_run(le, text, run, 1);
+		} else if (le->utf8 && (run = lineedit_utf8_run(text, len)) > 0) {
+			lineedit_insert_run(le, text, run, 0);
+		} else {
+			if (text[0] == '\n' && le->multiline) {
+				lineedit_insert_run(le, text, 1, 1);
+			}
+			run = 1;
+		}
+		text += run;
+		len -= run;
 	}
+	lineedit_output_release(le);
 
 	return LINEEDIT_INSERT_OK;
 }
 
 
+/* Append @a n characters of @a s to the label pool. */
+static int32_t lineedit_trie_label(struct lineedit_trie *t, char *labels, uint32_t labels_size, const char *s, uint32_t n) {
+	if ((t->labels_len + n) > labels_size) {
+		return -1;
+	}
+	memcpy(labels + t->labels_len, s, n);
+	t->labels_len += n;
+
+	return t->labels_len - n;
+}
+
+
+/* Insert @a word into the trie, splitting an edge if the word diverges
+ * inside its label. */
+static int32_t lineedit_trie_insert(struct lineedit_trie *t, struct lineedit_trie_node *nodes, uint32_t max_nodes, char *labels, uint32_t labels_size, const char *word) {
+	uint32_t node = 0;
+	uint32_t len = strlen(word);
+	uint32_t i = 0;
+
+	while (i < len) {
+		/* Find the child starting with the next character, siblings are
+		 * sorted. */
+		uint8_t c = word[i];
+		uint32_t prev = 0;
+		uint32_t child = nodes[node].child;
+		while (child != 0 && (uint8_t)labels[nodes[child].label] < c) {
+			prev = child;
+			child = nodes[child].sibling;
+		}
+
+		if (child == 0 || (uint8_t)labels[nodes[child].label] != c) {
+			/* Nothing matches, the rest of the word is a new leaf. */
+			if (t->node_count >= max_nodes || (len - i) > 0xffff) {
+				return -1;
+			}
+			int32_t label = lineedit_trie_label(t, labels, labels_size, word + i, len - i);
+			if (label < 0) {
+				return -1;
+			}
+			uint32_t leaf = t->node_count++;
+			nodes[leaf].label = label;
+			nodes[leaf].label_len = len - i;
+			nodes[leaf].flags = LINEEDIT_TRIE_WORD;
+			nodes[leaf].child = 0;
+			nodes[leaf].sibling = child;
+			if (prev != 0) {
+				nodes[prev].sibling = leaf;
+			} else {
+				nodes[node].child = leaf;
+			}
+			return 0;
+		}
+
+		struct lineedit_trie_node *n = &nodes[child];
+		uint32_t k = 1;
+		while (k < n->label_len && (i + k) < len && labels[n->label + k] == word[i + k]) {
+			k++;
+		}
+
+		if (k < n->label_len) {
+			/* The word diverges or ends inside the label. The rest of the
+			 * label is moved to a new node taking over all children. */
+			if (t->node_count >= max_nodes) {
+				return -1;
+			}
+			uint32_t rest = t->node_count++;
+			nodes[rest].label = n->label + k;
+			nodes[rest].label_len = n->label_len - k;
+			nodes[rest].flags = n->flags;
+			nodes[rest].child = n->child;
+			nodes[rest].sibling = 0;
+			n->label_len = k;
+			n->flags = 0;
+			n->child = rest;
+		}
+
+		node = child;
+		i += k;
+	}
+
+	nodes[node].flags |= LINEEDIT_TRIE_WORD;
+
+	return 0;
+}
+
+
+int32_t lineedit_trie_build(struct lineedit_trie *t, struct lineedit_trie_node *nodes, uint32_t max_nodes, char *labels, uint32_t labels_size, const char * const *words, uint32_t count) {
+	if (u_assert(t != NULL) ||
+	    u_assert(nodes != NULL) ||
+	    u_assert(max_nodes > 0) ||
+	    u_assert(labels != NULL) ||
+	    u_assert(words != NULL)) {
+		return LINEEDIT_TRIE_BUILD_FAILED;
+	}
+
+	memset(t, 0, sizeof(struct lineedit_trie));
+	memset(&nodes[0], 0, sizeof(struct lineedit_trie_node));
+	t->node_count = 1;
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (lineedit_trie_insert(t, nodes, max_nodes, labels, labels_size, words[i])) {
+			return LINEEDIT_TRIE_BUILD_FAILED;
+		}
+	}
+
+	t->nodes = nodes;
+	t->labels = labels;
+
+	return LINEEDIT_TRIE_BUILD_OK;
+}
+
+
+int32_t lineedit_set_completion(struct lineedit *le, const struct lineedit_trie *trie) {
+	if (u_assert(le != NULL)) {
+		return LINEEDIT_SET_COMPLETION_FAILED;
+	}
+
+	le->completion = trie;
+
+	return LINEEDIT_SET_COMPLETION_OK;
+}
+
+
+/* Find the trie position matching @a n characters of @a s. Returns the node
+ * the position is in and the number of its label characters matched in
+ * @a matched or -1 if nothing matches. Lookup cost depends on the length of
+ * @a s only, not on the vocabulary size. */
+static int32_t lineedit_trie_find(const struct lineedit_trie *t, const char *s, uint32_t n, uint32_t *matched) {
+	uint32_t node = 0;
+	uint32_t i = 0;
+
+	*matched = 0;
+	while (i < n) {
+		uint32_t child = t->nodes[node].child;
+		while (child != 0 && (uint8_t)t->labels[t->nodes[child].label] < (uint8_t)s[i]) {
+			child = t->nodes[child].sibling;
+		}
+		if (child == 0 || t->labels[t->nodes[child].label] != s[i]) {
+			return -1;
+		}
+
+		const struct lineedit_trie_node *c = &t->nodes[child];
+		uint32_t k = 1;
+		while (k < c->label_len && (i + k) < n) {
+			if (t->labels[c->label + k] != s[i + k]) {
+				return -1;
+			}
+			k++;
+		}
+
+		node = child;
+		i += k;
+		*matched = k;
+	}
+
+	return node;
+}
+
+
+/* State of listing completion candidates. The first pass computes the number
+ * and width of candidates, the second one prints them. */
+struct lineedit_completion_list {
+	char candidate[LINEEDIT_COMPLETION_LEN];
+	uint32_t count;
+	uint32_t width;
+	uint32_t columns;
+	uint32_t print;
+};
+
+
+static void lineedit_completion_emit(struct lineedit *le, struct lineedit_completion_list *list, uint32_t len) {
+	if (!list->print) {
+		list->count++;
+		if (len > list->width) {
+			list->width = len;
+		}
+		return;
+	}
+
+	lineedit_write(le, list->candidate, len);
+	list->count++;
+	if ((list->count % list->columns) == 0) {
+		lineedit_write(le, "\r\n", 2);
+	} else {
+		/* Pad to the column width. */
+		for (uint32_t i = len; i < (list->width + 2); i++) {
+			lineedit_write(le, " ", 1);
+		}
+	}
+}
+
+
+/* List candidates for the word under the cursor found in the subtree of
+ * @a node. Label characters from @a from are appended to the candidate of
+ * @a len characters until a space (end of the word) is found. */
+static void lineedit_completion_list(struct lineedit *le, struct lineedit_completion_list *list, uint32_t node, uint32_t from, uint32_t len) {
+	const struct lineedit_trie *t = le->completion;
+	const struct lineedit_trie_node *n = &t->nodes[node];
+
+	for (uint32_t i = from; i < n->label_len; i++) {
+		char c = t->labels[n->label + i];
+		if (c == ' ') {
+			lineedit_completion_emit(le, list, len);
+			return;
+		}
+		if (len < sizeof(list->candidate)) {
+			list->candidate[len++] = c;
+		}
+	}
+
+	if (n->flags & LINEEDIT_TRIE_WORD) {
+		lineedit_completion_emit(le, list, len);
+	}
+	for (uint32_t child = n->child; child != 0; child = t->nodes[child].sibling) {
+		/* Sub-commands of a word already listed. */
+		if ((n->flags & LINEEDIT_TRIE_WORD) && t->labels[t->nodes[child].label] == ' ') {
+			continue;
+		}
+		lineedit_completion_list(le, list, child, 0, len);
+	}
+}
+
+
+int32_t lineedit_complete(struct lineedit *le) {
+	if (u_assert(le != NULL) ||
+	    u_assert(le->completion != NULL)) {
+		return LINEEDIT_COMPLETE_FAILED;
+	}
+
+	const struct lineedit_trie *t = le->completion;
+
+	/* The line before the cursor is contiguous with the gap moved there.
+	 * In the multi-line mode, the command starts at the cursor row. */
+	lineedit_gap_move(le, le->cursor);
+	const char *s = le->text;
+	uint32_t n = le->cursor;
+	uint32_t start = n;
+	while (start > 0 && s[start - 1] != '\n') {
+		start--;
+	}
+
+	uint32_t matched = 0;
+	int32_t found = lineedit_trie_find(t, s + start, n - start, &matched);
+	if (found < 0) {
+		return LINEEDIT_COMPLETE_NONE;
+	}
+
+	/* Extend to the next branching or to the end of a word. */
+	uint32_t node = found;
+	char ext[LINEEDIT_COMPLETION_LEN];
+	uint32_t ext_len = 0;
+	while (1) {
+		const struct lineedit_trie_node *nd = &t->nodes[node];
+		while (matched < nd->label_len && ext_len < sizeof(ext)) {
+			ext[ext_len++] = t->labels[nd->label + matched];
+			matched++;
+		}
+		if (matched < nd->label_len || (nd->flags & LINEEDIT_TRIE_WORD) ||
+		    nd->child == 0 || t->nodes[nd->child].sibling != 0) {
+			break;
+		}
+		node = nd->child;
+		matched = 0;
+	}
+
+	const struct lineedit_trie_node *nd = &t->nodes[node];
+	if (matched == nd->label_len && (nd->flags & LINEEDIT_TRIE_WORD) && nd->child == 0 && ext_len < sizeof(ext)) {
+		/* The command is complete. */
+		ext[ext_len++] = ' ';
+	}
+
+	if (ext_len > 0) {
+		lineedit_output_hold(le);
+		lineedit_insert_run(le, ext, ext_len, 0);
+		lineedit_output_release(le);
+		return LINEEDIT_COMPLETE_OK;
+	}
+
+	/* Nothing to insert, list candidates for the word under the cursor. */
+	struct lineedit_completion_list list;
+	memset(&list, 0, sizeof(list));
+	uint32_t word = n;
+	while (word > start && s[word - 1] != ' ') {
+		word--;
+	}
+	uint32_t len = n - word;
+	if (len > sizeof(list.candidate)) {
+		len = sizeof(list.candidate);
+	}
+	memcpy(list.candidate, s + word, len);
+
+	lineedit_completion_list(le, &list, found, matched, len);
+	if (list.count == 0) {
+		return LINEEDIT_COMPLETE_NONE;
+	}
+
+	uint32_t width = (le->width > 0) ? le->width : LINEEDIT_TERMINAL_WIDTH;
+	list.columns = width / (list.width + 2);
+	if (list.columns == 0) {
+		list.columns = 1;
+	}
+	list.print = 1;
+	list.count = 0;
+
+	lineedit_output_hold(le);
 
+	/* The list is printed below all rows of the line. */
+	if (le->multiline && le->shadow_valid) {
+		uint32_t rows = lineedit_rows_count(le, le->shadow_cursor, le->shadow_len);
+		if (rows > 0) {
+			lineedit_escape_print(le, ESC_CURSOR_DOWN, rows);
+		}
+	}
+	le->shadow_row = 0;
+	lineedit_write(le, "\r\n", 2);
+	lineedit_completion_list(le, &list, found, matched, len);
+	if ((list.count % list.columns) != 0) {
+		lineedit_write(le, "\r\n", 2);
+	}
+	lineedit_refresh(le);
+	lineedit_output_release(le);
 
+	return LINEEDIT_COMPLETE_OK;
+}
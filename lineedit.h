@@ -33,8 +33,63 @@
 #define u_assert(e) ((e) ? (0) : (printf("Assertion '%s' failed in %s, line %d\n", #e, __FILE__, __LINE__), abort(), 1))
 #endif
 
-#ifndef LINEEDIT_HISTORY_LEN
-#define LINEEDIT_HISTORY_LEN 5
+/**
+ * Size of the history arena in bytes. Every history entry takes its length
+ * plus 5 bytes. The arena is enlarged to hold at least one full line.
+ */
+#ifndef LINEEDIT_HISTORY_SIZE
+#define LINEEDIT_HISTORY_SIZE 512
+#endif
+
+/**
+ * Size of the history arena for lines of @a line_len characters if
+ * @a history_size bytes are requested.
+ */
+#define LINEEDIT_HISTORY_ARENA_SIZE(line_len, history_size) \
+	(((history_size) > ((line_len) + 4)) ? (history_size) : ((line_len) + 4))
+
+/**
+ * Size of the storage needed by a line editor with lines of @a line_len
+ * characters and a history arena of @a history_size bytes. The storage holds
+ * the line buffer, its shadow copy and the history arena.
+ */
+#define LINEEDIT_STORAGE_SIZE(line_len, history_size) \
+	(2 * (line_len) + LINEEDIT_HISTORY_ARENA_SIZE((line_len), (history_size)))
+
+/**
+ * History flags used as arguments to @a lineedit_set_history_flags.
+ * LINEEDIT_HISTORY_IGNORE_DUPS skips lines equal to the newest entry,
+ * LINEEDIT_HISTORY_ERASE_DUPS removes all older entries equal to the new one.
+ */
+#define LINEEDIT_HISTORY_IGNORE_DUPS 1
+#define LINEEDIT_HISTORY_ERASE_DUPS 2
+
+/**
+ * Handling of newlines inside a bracketed paste, used as arguments to
+ * @a lineedit_set_paste_mode. Newlines are either dropped, replaced by spaces,
+ * they finish the line as if ENTER was pressed or they are kept in the line
+ * (in the multi-line mode only, they are replaced by spaces otherwise).
+ */
+#define LINEEDIT_PASTE_NEWLINE_IGNORE 0
+#define LINEEDIT_PASTE_NEWLINE_SPACE 1
+#define LINEEDIT_PASTE_NEWLINE_ENTER 2
+#define LINEEDIT_PASTE_NEWLINE_KEEP 3
+
+/**
+ * Per-context statistics are collected if set to non-zero value. Set to 0
+ * to compile them out.
+ */
+#ifndef LINEEDIT_STATS
+#define LINEEDIT_STATS 1
+#endif
+
+/**
+ * Number of buckets of the keypress latency histogram. Bucket 0 counts
+ * keypresses processed in 0 timestamp ticks, bucket n counts keypresses
+ * taking 2^(n-1) to 2^n - 1 ticks, the last one counts the rest.
+ */
+#ifndef LINEEDIT_STATS_LATENCY_BUCKETS
+#define LINEEDIT_STATS_LATENCY_BUCKETS 16
 #endif
 
 /**
@@ -53,22 +108,300 @@
 
 /**
  * Output escape sequence passed as an argument to @a lineedit_escape_print
- * function.
+ * function. Cursor movements take the number of columns (or rows) as
+ * a parameter, ESC_CURSOR_COLUMN moves to an absolute column (starting
+ * with 1). ESC_ERASE_SCREEN_END erases the rest of the row and all rows
+ * below.
+ * ESC_BRACKETED_PASTE enables (param 1) or disables (param 0) the bracketed
+ * paste mode of the terminal.
  */
 enum lineedit_escape_seq {
 	ESC_CURSOR_LEFT,
 	ESC_CURSOR_RIGHT,
+	ESC_CURSOR_COLUMN,
 	ESC_COLOR,
 	ESC_DEFAULT,
 	ESC_BOLD,
 	ESC_CURSOR_SAVE,
 	ESC_CURSOR_RESTORE,
-	ESC_ERASE_LINE_END
+	ESC_ERASE_LINE_END,
+	ESC_BRACKETED_PASTE,
+	ESC_CURSOR_UP,
+	ESC_CURSOR_DOWN,
+	ESC_ERASE_SCREEN_END
 };
 
 
+/**
+ * Maximum number of numeric parameters of an input CSI sequence. Sequences
+ * with more parameters are ignored.
+ */
+#ifndef LINEEDIT_CSI_PARAMS
+#define LINEEDIT_CSI_PARAMS 4
+#endif
+
+/**
+ * States of the input escape sequence decoder.
+ */
 enum lineedit_escape {
-	ESC_NONE, ESC_ESC, ESC_CSI, ESC_OSC
+	ESC_NONE,
+	ESC_ESC,
+	ESC_CSI,
+	ESC_CSI_INTERMEDIATE,
+	ESC_CSI_IGNORE,
+	ESC_SS3,
+	ESC_OSC,
+	ESC_OSC_ESC,
+	ESC_STATES
+};
+
+
+/**
+ * Keys decoded from input escape sequences. Modifiers pressed together with
+ * the key are reported as a combination of LINEEDIT_MOD_* flags.
+ */
+enum lineedit_key {
+	LINEEDIT_KEY_NONE,
+	LINEEDIT_KEY_UP,
+	LINEEDIT_KEY_DOWN,
+	LINEEDIT_KEY_RIGHT,
+	LINEEDIT_KEY_LEFT,
+	LINEEDIT_KEY_HOME,
+	LINEEDIT_KEY_END,
+	LINEEDIT_KEY_INSERT,
+	LINEEDIT_KEY_DELETE,
+	LINEEDIT_KEY_PAGE_UP,
+	LINEEDIT_KEY_PAGE_DOWN,
+	LINEEDIT_KEY_F1,
+	LINEEDIT_KEY_F2,
+	LINEEDIT_KEY_F3,
+	LINEEDIT_KEY_F4,
+	LINEEDIT_KEY_F5,
+	LINEEDIT_KEY_F6,
+	LINEEDIT_KEY_F7,
+	LINEEDIT_KEY_F8,
+	LINEEDIT_KEY_F9,
+	LINEEDIT_KEY_F10,
+	LINEEDIT_KEY_F11,
+	LINEEDIT_KEY_F12,
+	LINEEDIT_KEY_PASTE_START,
+	LINEEDIT_KEY_PASTE_END
+};
+
+#define LINEEDIT_MOD_SHIFT 1
+#define LINEEDIT_MOD_ALT 2
+#define LINEEDIT_MOD_CTRL 4
+
+
+/**
+ * Circular byte arena storing variable length records back to back. Each
+ * record consists of a 16 bit header (payload length and a deleted flag),
+ * the payload and a 16 bit trailer (payload length) allowing to walk the
+ * records in both directions. Records never wrap around the end of the
+ * buffer, the valid data end at @a wrap if the newer records continue
+ * from the beginning. Oldest records are evicted to make space for new ones.
+ */
+struct lineedit_ring {
+	uint8_t *buf;
+	uint32_t size;
+
+	/**
+	 * Start of the oldest record, end of the newest record and number of
+	 * records (including deleted ones).
+	 */
+	uint32_t tail;
+	uint32_t head;
+	uint32_t wrap;
+	uint32_t count;
+};
+
+
+/**
+ * Size of a single slot of a shared history holding lines of @a line_len
+ * characters (including the terminator).
+ */
+#define LINEEDIT_SHARED_HISTORY_SLOT_SIZE(line_len) ((6 + (line_len) + 3) & ~3)
+
+/**
+ * Storage needed by a shared history of @a entries lines of @a line_len
+ * characters. It includes up to 3 bytes skipped to align the slots to
+ * 4 bytes if the storage is not aligned. The number of slots is rounded
+ * down to a power of two, use a power of two for @a entries not to waste
+ * any storage.
+ */
+#define LINEEDIT_SHARED_HISTORY_SIZE(line_len, entries) \
+	((entries) * LINEEDIT_SHARED_HISTORY_SLOT_SIZE(line_len) + 3)
+
+/**
+ * History shared by multiple line editors which may run in different
+ * threads. Entries are stored in fixed size slots, the entry with sequence
+ * number n in slot n % @a slot_count. Writers claim sequence numbers by
+ * atomically incrementing @a head, no lock is taken. Every slot starts
+ * with a 32 bit stamp, it is odd while the entry is written and equal to
+ * 2 * n + 2 when entry n is complete. A writer never waits, the entry is
+ * dropped if the slot is still being written by a writer a lap behind.
+ * Readers copy the entry and check the stamp did not change meanwhile,
+ * they never block writers. Slot contents are accessed atomically byte by
+ * byte, a torn copy is discarded.
+ */
+struct lineedit_shared_history {
+	uint8_t *slots;
+	uint32_t slot_count;
+	uint32_t slot_size;
+	uint32_t line_len;
+
+	/**
+	 * Sequence number of the next entry, accessed atomically.
+	 */
+	uint32_t head;
+};
+
+
+/**
+ * Statistics of a single line editor context, see @a lineedit_get_stats.
+ */
+struct lineedit_stats {
+	/**
+	 * Number of input characters processed (by lineedit_keypress or
+	 * lineedit_feed).
+	 */
+	uint32_t keypresses;
+
+	/**
+	 * Output statistics. Number of bytes passed to the print handler,
+	 * number of its calls and number of escape sequences printed.
+	 */
+	uint32_t bytes;
+	uint32_t print_calls;
+	uint32_t escapes;
+
+	/**
+	 * Number of output bytes dropped because the print handler was blocked
+	 * and there was no space to queue them, and number of redraws deferred
+	 * until the output was resumed.
+	 */
+	uint32_t dropped;
+	uint32_t deferred;
+
+	/**
+	 * Number of full line refreshes and partial updates.
+	 */
+	uint32_t refreshes;
+	uint32_t updates;
+
+	/**
+	 * Number of entries appended to the history and entries evicted to make
+	 * space for them.
+	 */
+	uint32_t history_appends;
+	uint32_t history_evictions;
+
+	/**
+	 * Histogram of keypress processing times, collected only if
+	 * a timestamp function is set using @a lineedit_set_timestamp.
+	 */
+	uint32_t latency[LINEEDIT_STATS_LATENCY_BUCKETS];
+};
+
+
+/**
+ * Terminal width used to arrange completion candidates in columns if it was
+ * not set using @a lineedit_set_width.
+ */
+#ifndef LINEEDIT_TERMINAL_WIDTH
+#define LINEEDIT_TERMINAL_WIDTH 80
+#endif
+
+/**
+ * Maximum length of a completion candidate listed and of the text inserted
+ * by a single completion. Longer ones are truncated.
+ */
+#ifndef LINEEDIT_COMPLETION_LEN
+#define LINEEDIT_COMPLETION_LEN 64
+#endif
+
+/**
+ * Maximum length of the incremental history search query (Ctrl-R).
+ */
+#ifndef LINEEDIT_SEARCH_LEN
+#define LINEEDIT_SEARCH_LEN 32
+#endif
+
+/**
+ * Maximum length of the rendered prompt (including escape sequences) which
+ * is cached. Longer prompts are rendered by the prompt callback every time.
+ */
+#ifndef LINEEDIT_PROMPT_LEN
+#define LINEEDIT_PROMPT_LEN 64
+#endif
+
+/**
+ * Number of leading bytes of history entries indexed for autosuggestions.
+ * Lines longer than that are matched by walking the chain of entries
+ * starting with the same bytes.
+ */
+#ifndef LINEEDIT_HINT_DEPTH
+#define LINEEDIT_HINT_DEPTH 8
+#endif
+
+/**
+ * Maximum number of history entries compared when looking up an
+ * autosuggestion. It bounds the time taken by a keypress when many entries
+ * start with the same bytes.
+ */
+#ifndef LINEEDIT_HINT_WALK
+#define LINEEDIT_HINT_WALK 64
+#endif
+
+/**
+ * SGR colour of the autosuggestion (bright black by default).
+ */
+#ifndef LINEEDIT_HINT_COLOR
+#define LINEEDIT_HINT_COLOR 90
+#endif
+
+/**
+ * Node of a command completion trie. Edges are labelled by strings stored
+ * in a common label pool (radix trie), children of a node are linked in
+ * a sibling list sorted by their first character. All references are
+ * indices, node 0 is the root. A built trie contains no pointers and can be
+ * stored in read-only memory.
+ */
+struct lineedit_trie_node {
+	/**
+	 * Label of the edge leading to this node, @a label_len characters
+	 * starting at offset @a label of the label pool.
+	 */
+	uint32_t label;
+	uint16_t label_len;
+
+	/**
+	 * LINEEDIT_TRIE_WORD if a word of the vocabulary ends here.
+	 */
+	uint16_t flags;
+
+	/**
+	 * Index of the first child and of the next sibling, 0 if there is none.
+	 */
+	uint32_t child;
+	uint32_t sibling;
+};
+
+#define LINEEDIT_TRIE_WORD 1
+
+/**
+ * Number of nodes needed for a vocabulary of @a count words.
+ */
+#define LINEEDIT_TRIE_NODES(count) (2 * (count) + 1)
+
+/**
+ * Command completion trie, see @a lineedit_trie_build.
+ */
+struct lineedit_trie {
+	const struct lineedit_trie_node *nodes;
+	uint32_t node_count;
+	const char *labels;
+	uint32_t labels_len;
 };
 
 
@@ -78,23 +411,116 @@ enum lineedit_escape {
  */
 struct lineedit {
 	/**
-	 * Actual cursor position. Valid during line ediding.
+	 * Actual cursor position (byte offset in the line). Valid during line
+	 * ediding. It is always at a character boundary.
 	 */
 	uint32_t cursor;
 
 	/**
 	 * Pointer to line buffer of @a len length. It is used to store last
-	 * (actually edited) line.
+	 * (actually edited) line of @a text_len characters. The buffer is a gap
+	 * buffer, characters before @a gap_start are at the beginning, the rest
+	 * is stored at the end starting from @a gap_end. Use @a lineedit_get_line
+	 * to get the line as a contiguous string.
 	 */
 	char *text;
 	uint32_t len;
+	uint32_t text_len;
+	uint32_t gap_start;
+	uint32_t gap_end;
+
+	/**
+	 * Display width cache. The line occupies @a text_cols terminal
+	 * columns, @a cursor_col of them are left of the cursor. Both are
+	 * updated by every edit using only the widths of the characters
+	 * inserted, removed or passed by the cursor. If @a text_cols equals
+	 * @a text_len, the line is plain ASCII and widths are not computed
+	 * at all.
+	 */
+	uint32_t text_cols;
+	uint32_t cursor_col;
+
+	/**
+	 * Shadow copy of the line as currently displayed on the terminal
+	 * (after the prompt), @a shadow_len bytes long occupying
+	 * @a shadow_cols columns. The terminal cursor is at @a shadow_cursor
+	 * (column @a shadow_cursor_col). Used to compute minimal updates,
+	 * valid only if @a shadow_valid is set.
+	 */
+	char *shadow;
+	uint32_t shadow_len;
+	uint32_t shadow_cols;
+	uint32_t shadow_cursor;
+	uint32_t shadow_cursor_col;
+	uint32_t shadow_valid;
+
+	/**
+	 * Terminal width in columns or 0 if unknown. If the line does not fit,
+	 * only a part of it from position @a view (column @a view_col) up to
+	 * @a view_end is displayed around the cursor. Overflow markers are
+	 * shown where the line continues.
+	 */
+	uint32_t width;
+	uint32_t view;
+	uint32_t view_col;
+	uint32_t view_end;
+
+	/**
+	 * Multi-line mode. Newlines split the line to rows, rows following the
+	 * first one are displayed after @a cont_prompt (@a cont_prompt_len
+	 * bytes taking @a cont_prompt_width columns). The terminal cursor is
+	 * @a shadow_row rows below the first one.
+	 */
+	uint32_t multiline;
+	const char *cont_prompt;
+	uint32_t cont_prompt_len;
+	uint32_t cont_prompt_width;
+	uint32_t shadow_row;
+
+	/**
+	 * Undo log in a buffer supplied by @a lineedit_set_undo_buffer. Its
+	 * records are edits of the line (inserted or deleted text and its
+	 * position). @a undo_done records were done, the following ones from
+	 * @a undo_pos were undone and they can be redone. @a undo_merge is set
+	 * if the next edit may be merged with the newest record.
+	 */
+	struct lineedit_ring undo;
+	uint32_t undo_pos;
+	uint32_t undo_done;
+	uint32_t undo_merge;
 
 	/**
-	 * Input terminal/console escape sequence state. @a csi_escape_mod is
-	 * valid only if @a escape equals ESC_CSI.
+	 * Input terminal/console escape sequence decoder state. Parameters of
+	 * the CSI or SS3 sequence being received are collected in
+	 * @a csi_params, @a csi_count is their number (it may exceed the
+	 * array size). @a csi_ignore is set if the sequence contains private
+	 * markers or intermediate characters. The last decoded key and its
+	 * modifiers are saved in @a key and @a key_mod.
 	 */
 	enum lineedit_escape escape;
-	uint32_t csi_escape_mod;
+	uint16_t csi_params[LINEEDIT_CSI_PARAMS];
+	uint8_t csi_count;
+	uint8_t csi_ignore;
+	enum lineedit_key key;
+	uint32_t key_mod;
+
+	/**
+	 * If set, input is decoded as UTF-8 (default). Bytes of a partially
+	 * received character are collected in @a utf8_seq.
+	 */
+	uint32_t utf8;
+	uint8_t utf8_seq[4];
+	uint8_t utf8_len;
+	uint8_t utf8_need;
+
+	/**
+	 * Bracketed paste handling. If @a paste_mode is set, the terminal is
+	 * asked to mark pasted text. @a paste is set while the pasted text is
+	 * being received, newlines are handled according to @a paste_newline.
+	 */
+	uint32_t paste_mode;
+	uint32_t paste_newline;
+	uint32_t paste;
 
 	/**
 	 * Optional charater to be substituted for all printed characters.
@@ -106,30 +532,188 @@ struct lineedit {
 	 * Function called whenever there's a need to print anything to editor
 	 * output terminal/console. Needs to be set after context initialization
 	 * and before using keypress function. @a ctx is passed as an argument
-	 * to @a print_handler function.
+	 * to @a print_handler function. It returns 0 if the whole string was
+	 * written or the number of bytes at its end it was not able to write
+	 * (eg. a non-blocking socket is full), see @a lineedit_output_resume.
 	 */
 	int32_t (*print_handler)(const char *line, void *ctx);
 	void *print_handler_ctx;
 
+	/**
+	 * Optional output staging buffer of @a out_size bytes supplied by the
+	 * caller using @a lineedit_set_output_buffer. If set, all output is
+	 * collected here and passed to @a print_handler as a single string
+	 * when the outermost lineedit operation finishes (or when the buffer
+	 * fills up). @a out_hold is the nesting depth of running operations,
+	 * @a out_saved counts print_handler calls avoided by coalescing.
+	 */
+	char *out_buf;
+	uint32_t out_size;
+	uint32_t out_used;
+	uint32_t out_hold;
+	uint32_t out_saved;
+
+	/**
+	 * Set if the print handler was not able to write everything. Unsent
+	 * output is then kept in the staging buffer, redraws are deferred and
+	 * @a redraw_pending is set instead.
+	 */
+	uint32_t out_blocked;
+	uint32_t redraw_pending;
+
+	/**
+	 * Set if the edited line was erased by @a lineedit_print_above. It is
+	 * redrawn once the burst of messages is flushed.
+	 */
+	uint32_t line_hidden;
+
 	/**
 	 * Function called when a line command prompt (a beginning of edited line)
 	 * should be printed. @a ctx is passed as an argument to @a prompt_callback.
+	 * It returns the number of columns the prompt occupies or a negative
+	 * number on error.
+	 * The callback should print using @a lineedit_print or
+	 * @a lineedit_escape_print to keep the output ordered when an output
+	 * buffer is used.
 	 */
 	int32_t (*prompt_callback)(struct lineedit *le, void *ctx);
 	void *prompt_callback_ctx;
+
+	/**
+	 * Output of the prompt callback is rendered once into @a prompt_cache
+	 * (@a prompt_cache_len bytes) and printed from there until
+	 * @a lineedit_invalidate_prompt is called. @a prompt_cache_width is
+	 * the number of columns it takes, escape sequences excluded.
+	 * @a prompt_state tells if the cache is invalid (0), being filled by
+	 * the running prompt callback (1) or holds the rendered prompt (2).
+	 * @a prompt_len is the width of the prompt currently displayed, which
+	 * is used to position the cursor.
+	 */
+	char prompt_cache[LINEEDIT_PROMPT_LEN];
+	uint32_t prompt_cache_len;
+	uint32_t prompt_cache_width;
+	uint32_t prompt_state;
 	uint32_t prompt_len;
 
 	/**
-	 * History is saved in a single string split into individual history
-	 * entries. Each entry is @a len characters long. Empty history strings
-	 * are not considered valid (they are skipped).
+	 * History entries are length prefixed and suffixed records of
+	 * a circular arena (struct lineedit_ring), the payload is the line
+	 * including its terminator. The oldest are evicted first. Deleted
+	 * entries (duplicates) are kept in the arena until evicted.
+	 * @a history_count is the number of valid entries. Position of the last recalled entry is cached in
+	 * @a history_cache_index and @a history_cache_off to make browsing
+	 * through the history cheap.
 	 */
-	char *history;
-	uint32_t history_size;
+	struct lineedit_ring history;
+	uint32_t history_count;
+	uint32_t history_flags;
+	int32_t history_cache_index;
+	uint32_t history_cache_off;
 	int32_t recall_index;
+
+	/**
+	 * Autosuggestion index of @a hint_buckets buckets. Every bucket holds
+	 * the sequence number and arena offset of the newest entry longer than
+	 * a prefix hashed to it and starting with it. Prefixes of
+	 * LINEEDIT_HINT_DEPTH bytes use a second set of buckets, the entries
+	 * are chained there. Links to the previous entry of the chain follow,
+	 * entry n uses link n % @a hint_buckets. @a history_seq counts entries
+	 * allocated in the arena, the newest @a history.count of them are
+	 * present.
+	 * The displayed suggestion is the part of entry @a hint_seq between
+	 * @a hint_start and @a hint_end, taking @a hint_cols columns.
+	 */
+	uint32_t *hint_index;
+	uint32_t hint_buckets;
+	uint32_t history_seq;
+	uint32_t hint_seq;
+	uint32_t hint_off;
+	uint32_t hint_start;
+	uint32_t hint_end;
+	uint32_t hint_cols;
+
+	/**
+	 * Called after a line is saved to the history with the saved copy
+	 * of the line (eg. to write it to a persistent log).
+	 */
+	void (*history_callback)(struct lineedit *le, const char *line, void *ctx);
+	void *history_callback_ctx;
+
+	/**
+	 * If a shared history is set, it is used instead of the history arena.
+	 * Recall indices are relative to @a shared_anchor, the sequence number
+	 * following the newest entry when browsing started, so they are not
+	 * shifted by entries appended by other editors meanwhile. The arena
+	 * holds a copy of the last recalled entry.
+	 */
+	struct lineedit_shared_history *shared_history;
+	uint32_t shared_anchor;
+
+#if LINEEDIT_STATS
+	/**
+	 * Context statistics. Keypress latency is measured using the optional
+	 * @a timestamp function returning current time in arbitrary ticks.
+	 */
+	struct lineedit_stats stats;
+	uint32_t (*timestamp)(void *ctx);
+	void *timestamp_ctx;
+#endif
+
+	/**
+	 * Set if the storage was allocated by @a lineedit_init and has to be
+	 * freed by @a lineedit_free.
+	 */
+	uint32_t storage_allocated;
+
+	/**
+	 * Incremental history search state (Ctrl-R). If @a search is set,
+	 * @a search_label followed by the matching history entry
+	 * (@a search_line) is displayed instead of the prompt and the edited
+	 * line. The entry index and the match position are kept for every
+	 * length of @a search_query, a longer query continues searching from
+	 * the previous match and a shorter one needs no search at all.
+	 * Index -1 means the edited line is displayed. Queries longer than
+	 * @a search_failed_len (if set) have no match.
+	 */
+	uint32_t search;
+	char search_query[LINEEDIT_SEARCH_LEN];
+	uint32_t search_len;
+	int32_t search_match[LINEEDIT_SEARCH_LEN + 1];
+	uint16_t search_pos[LINEEDIT_SEARCH_LEN + 1];
+	uint32_t search_failed_len;
+	const char *search_line;
+	uint32_t search_line_len;
+	char search_label[LINEEDIT_SEARCH_LEN + 32];
+	uint32_t search_label_len;
+
+	/**
+	 * Vocabulary used to complete commands when TAB is pressed. If not
+	 * set, LINEEDIT_TAB is returned to the application instead.
+	 */
+	const struct lineedit_trie *completion;
 };
 
 
+/**
+ * Type of a line editor including its storage, for lines of @a line_len
+ * characters and a history arena of @a history_size bytes. Use it to declare
+ * statically allocated editors or to embed them in other structures, then
+ * initialize with @a LINEEDIT_STATIC_INIT. For example:
+ *
+ *     static LINEEDIT_STATIC_TYPE(80, 1024) console;
+ *     LINEEDIT_STATIC_INIT(&console, 80);
+ *     lineedit_keypress(&console.le, c);
+ */
+#define LINEEDIT_STATIC_TYPE(line_len, history_size) \
+	struct { \
+		struct lineedit le; \
+		uint8_t storage[LINEEDIT_STORAGE_SIZE((line_len), (history_size))]; \
+	}
+
+#define LINEEDIT_STATIC_INIT(editor, line_len) \
+	lineedit_init_static(&(editor)->le, (line_len), (editor)->storage, sizeof((editor)->storage))
+
+
 int32_t lineedit_print(struct lineedit *le, const char *s);
 #define LINEEDIT_PRINT_OK 0
 #define LINEEDIT_PRINT_FAILED -1
@@ -138,10 +722,138 @@ int32_t lineedit_escape_print(struct lineedit *le, enum lineedit_escape_seq esc,
 #define LINEEDIT_ESCAPE_PRINT_OK 0
 #define LINEEDIT_ESCAPE_PRINT_FAILED -1
 
+/**
+ * @brief Set an output staging buffer.
+ *
+ * All subsequent output is collected in @a buf and passed to the print
+ * handler in a single call at the end of each lineedit operation (eg. one
+ * call per lineedit_keypress). If the buffer fills up, it is flushed
+ * automatically. The buffer must remain valid while the context is used.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param buf Buffer to stage output in. NULL disables buffering.
+ * @param size Size of @a buf in bytes, at least 2 (one byte is reserved
+ *             for the string terminator).
+ *
+ * @return LINEEDIT_SET_OUTPUT_BUFFER_OK on success or
+ *         LINEEDIT_SET_OUTPUT_BUFFER_FAILED otherwise.
+ */
+int32_t lineedit_set_output_buffer(struct lineedit *le, char *buf, uint32_t size);
+#define LINEEDIT_SET_OUTPUT_BUFFER_OK 0
+#define LINEEDIT_SET_OUTPUT_BUFFER_FAILED -1
+
+/**
+ * @brief Pass all staged output to the print handler.
+ *
+ * Called automatically at the end of every lineedit operation. It may be
+ * called explicitly if the application writes to the same output directly.
+ * The edited line hidden by @a lineedit_print_above is redrawn first.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_FLUSH_OK on success or LINEEDIT_FLUSH_FAILED otherwise.
+ */
+int32_t lineedit_flush(struct lineedit *le);
+#define LINEEDIT_FLUSH_OK 0
+#define LINEEDIT_FLUSH_FAILED -1
+
+/**
+ * @brief Check if the output is blocked.
+ *
+ * Output is blocked after the print handler reported it was not able to
+ * write the whole string. Unsent bytes are queued in the output buffer
+ * (without the buffer they are lost), further output is appended while
+ * there is space and dropped otherwise. Line redraws are not queued, they
+ * are collapsed into a single redraw made by @a lineedit_output_resume.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param pending Number of queued bytes is returned here. Can be NULL.
+ *
+ * @return LINEEDIT_OUTPUT_PENDING_OK if the output is not blocked,
+ *         LINEEDIT_OUTPUT_PENDING_BLOCKED if lineedit_output_resume should
+ *         be called when the output is writable again or
+ *         LINEEDIT_OUTPUT_PENDING_FAILED otherwise.
+ */
+int32_t lineedit_output_pending(struct lineedit *le, uint32_t *pending);
+#define LINEEDIT_OUTPUT_PENDING_OK 0
+#define LINEEDIT_OUTPUT_PENDING_FAILED -1
+#define LINEEDIT_OUTPUT_PENDING_BLOCKED 1
+
+/**
+ * @brief Continue blocked output.
+ *
+ * Passes queued output to the print handler. If everything is written,
+ * the line is redrawn if any redraw was deferred meanwhile.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_OUTPUT_RESUME_OK if the output is not blocked anymore,
+ *         LINEEDIT_OUTPUT_RESUME_BLOCKED if the print handler blocked again
+ *         or LINEEDIT_OUTPUT_RESUME_FAILED otherwise.
+ */
+int32_t lineedit_output_resume(struct lineedit *le);
+#define LINEEDIT_OUTPUT_RESUME_OK 0
+#define LINEEDIT_OUTPUT_RESUME_FAILED -1
+#define LINEEDIT_OUTPUT_RESUME_BLOCKED 1
+
+/**
+ * @brief Print a message above the edited line.
+ *
+ * The edited line is erased before the first message and the message is
+ * printed in its place, ending with a newline. The line is not redrawn
+ * after every message, it is redrawn once by @a lineedit_flush (or by any
+ * other lineedit operation). A burst of messages should be printed first
+ * and flushed then. Newlines in @a msg are printed as CR LF.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param msg Message to print. Cannot be NULL.
+ *
+ * @return LINEEDIT_PRINT_ABOVE_OK on success or
+ *         LINEEDIT_PRINT_ABOVE_FAILED if the message was not printed.
+ */
+int32_t lineedit_print_above(struct lineedit *le, const char *msg);
+#define LINEEDIT_PRINT_ABOVE_OK 0
+#define LINEEDIT_PRINT_ABOVE_FAILED -1
+
+/**
+ * @brief Get the number of print handler calls saved by output buffering.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param saved Number of print requests which were coalesced into another
+ *              print handler call. Cannot be NULL.
+ *
+ * @return LINEEDIT_GET_SAVED_CALLS_OK on success or
+ *         LINEEDIT_GET_SAVED_CALLS_FAILED otherwise.
+ */
+int32_t lineedit_get_saved_calls(struct lineedit *le, uint32_t *saved);
+#define LINEEDIT_GET_SAVED_CALLS_OK 0
+#define LINEEDIT_GET_SAVED_CALLS_FAILED -1
+
 int32_t lineedit_init(struct lineedit *le, uint32_t line_len);
 #define LINEEDIT_INIT_OK 0
 #define LINEEDIT_INIT_FAILED -1
 
+/**
+ * @brief Initialize a line editor using caller supplied storage.
+ *
+ * No memory is allocated. The line buffer and its shadow copy take
+ * 2 * @a line_len bytes at the beginning of @a storage, the rest is used as
+ * the history arena. lineedit_free does not free the storage.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param line_len Maximum line length including the string terminator.
+ * @param storage Storage for all editor buffers, it must remain valid
+ *                while the context is used. Cannot be NULL.
+ * @param size Size of @a storage in bytes, at least
+ *             LINEEDIT_STORAGE_SIZE(line_len, 0).
+ *
+ * @return LINEEDIT_INIT_STATIC_OK on success or LINEEDIT_INIT_STATIC_FAILED
+ *         otherwise.
+ */
+int32_t lineedit_init_static(struct lineedit *le, uint32_t line_len, uint8_t *storage, uint32_t size);
+#define LINEEDIT_INIT_STATIC_OK 0
+#define LINEEDIT_INIT_STATIC_FAILED -1
+
 int32_t lineedit_free(struct lineedit *le);
 #define LINEEDIT_FREE_OK 0
 #define LINEEDIT_FREE_FAILED -1
@@ -149,8 +861,9 @@ int32_t lineedit_free(struct lineedit *le);
 /**
  * @brief Append new string to history.
  *
- * Function shifts the whole history by one line and copies new history entry
- * to the first position.
+ * Function copies new history entry after the newest one in the history arena,
+ * evicting the oldest entries if there is not enough space. Empty lines are
+ * not saved, duplicates are handled according to history flags.
  *
  * @param le Lineedit context to save history line to. Cannot be NULL.
  * @param line New line to be appended. Cannot be NULL.
@@ -171,9 +884,9 @@ int32_t lineedit_history_append(struct lineedit *le, const char *line);
  *
  * @param le Lineedit context to recall a line from. Cannot be NULL.
  * @param line Pointer to string containing the returned line. Cannot be NULL.
- * @param recall_index Index of history entry to recall. Return empty line
- *                     (currently edited line) for -1. Must be smaller than
- *                     allocated history size.
+ * @param recall_index Index of history entry to recall, 0 is the newest
+ *                     one. Return empty line (currently edited line) for -1.
+ *                     Must be smaller than number of saved entries.
  *
  * @return LINEEDIT_HISTORY_RECALL_OK on success or
  *         LINEEDIT_HISTORY_RECALL_FAILED otherwise (parameters invalid).
@@ -182,20 +895,290 @@ int32_t lineedit_history_recall(struct lineedit *le, char **line, int32_t recall
 #define LINEEDIT_HISTORY_RECALL_OK 0
 #define LINEEDIT_HISTORY_RECALL_FAILED -1
 
+/**
+ * @brief Set history duplicate handling.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param flags Combination of LINEEDIT_HISTORY_IGNORE_DUPS (default) and
+ *              LINEEDIT_HISTORY_ERASE_DUPS.
+ *
+ * @return LINEEDIT_SET_HISTORY_FLAGS_OK on success or
+ *         LINEEDIT_SET_HISTORY_FLAGS_FAILED otherwise.
+ */
+int32_t lineedit_set_history_flags(struct lineedit *le, uint32_t flags);
+#define LINEEDIT_SET_HISTORY_FLAGS_OK 0
+#define LINEEDIT_SET_HISTORY_FLAGS_FAILED -1
+
+/**
+ * @brief Set a function called after every line saved to the history.
+ *
+ * The callback is not called for empty lines and ignored duplicates.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param callback Function receiving the saved line or NULL to disable it.
+ * @param ctx Context passed to the @a callback.
+ *
+ * @return LINEEDIT_SET_HISTORY_CALLBACK_OK on success or
+ *         LINEEDIT_SET_HISTORY_CALLBACK_FAILED otherwise.
+ */
+int32_t lineedit_set_history_callback(struct lineedit *le, void (*callback)(struct lineedit *le, const char *line, void *ctx), void *ctx);
+#define LINEEDIT_SET_HISTORY_CALLBACK_OK 0
+#define LINEEDIT_SET_HISTORY_CALLBACK_FAILED -1
+
+/**
+ * @brief Replace the history arena.
+ *
+ * The editor continues with the history stored in @a ring (eg. a snapshot
+ * mapped from a file) instead of its own arena. No records are parsed, the
+ * ring is used as is. The arena must remain valid while the context is used
+ * or until another one is attached.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param ring Arena buffer and state of its records. The arena must be able
+ *             to hold at least one full line. Cannot be NULL.
+ * @param count Number of valid (not deleted) records in the arena.
+ *
+ * @return LINEEDIT_HISTORY_ATTACH_OK on success or
+ *         LINEEDIT_HISTORY_ATTACH_FAILED otherwise (ring state invalid).
+ */
+int32_t lineedit_history_attach(struct lineedit *le, const struct lineedit_ring *ring, uint32_t count);
+#define LINEEDIT_HISTORY_ATTACH_OK 0
+#define LINEEDIT_HISTORY_ATTACH_FAILED -1
+
+/**
+ * @brief Enable autosuggestions from the history.
+ *
+ * The most recent history entry extending the edited line is displayed
+ * after it in a dim colour (LINEEDIT_HINT_COLOR). Right or End pressed at
+ * the end of the line accepts it. Entries are looked up using a prefix index
+ * which is updated as lines are appended. Suggestions are not displayed
+ * in the multi-line mode, with a shared history, for hidden input or when
+ * the line is scrolled.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param index Index of LINEEDIT_HINT_INDEX_LEN(@a buckets) words or NULL
+ *              to disable autosuggestions. It must remain valid while
+ *              the context is used.
+ * @param buckets Number of index buckets. Lines longer than
+ *                LINEEDIT_HINT_DEPTH bytes are only matched against
+ *                the newest @a buckets entries.
+ *
+ * @return LINEEDIT_SET_HINT_INDEX_OK on success or
+ *         LINEEDIT_SET_HINT_INDEX_FAILED otherwise.
+ */
+int32_t lineedit_set_hint_index(struct lineedit *le, uint32_t *index, uint32_t buckets);
+#define LINEEDIT_SET_HINT_INDEX_OK 0
+#define LINEEDIT_SET_HINT_INDEX_FAILED -1
+#define LINEEDIT_HINT_INDEX_LEN(buckets) (6 * (buckets))
+
+/**
+ * @brief Initialize a history shared by multiple line editors.
+ *
+ * @param sh Shared history context. Cannot be NULL.
+ * @param line_len Maximum line length including the terminator, longer
+ *                 lines are truncated.
+ * @param storage Storage for the entries, at least
+ *                LINEEDIT_SHARED_HISTORY_SIZE(line_len, 1) bytes. It must
+ *                remain valid while the history is used. Cannot be NULL.
+ * @param size Size of @a storage in bytes.
+ *
+ * @return LINEEDIT_SHARED_HISTORY_INIT_OK on success or
+ *         LINEEDIT_SHARED_HISTORY_INIT_FAILED otherwise.
+ */
+int32_t lineedit_shared_history_init(struct lineedit_shared_history *sh, uint32_t line_len, uint8_t *storage, uint32_t size);
+#define LINEEDIT_SHARED_HISTORY_INIT_OK 0
+#define LINEEDIT_SHARED_HISTORY_INIT_FAILED -1
+
+/**
+ * @brief Use a shared history instead of the history of the line editor.
+ *
+ * Lines entered in any of the editors using the same shared history can be
+ * recalled in all of them. Every editor can be used from a different thread,
+ * appends and recalls do not need any locking. Entries saved in the own
+ * history of the editor are discarded. Duplicates are never erased from
+ * a shared history (LINEEDIT_HISTORY_ERASE_DUPS is ignored).
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param sh Initialized shared history or NULL to use the own (empty)
+ *           history again.
+ *
+ * @return LINEEDIT_SET_SHARED_HISTORY_OK on success or
+ *         LINEEDIT_SET_SHARED_HISTORY_FAILED otherwise.
+ */
+int32_t lineedit_set_shared_history(struct lineedit *le, struct lineedit_shared_history *sh);
+#define LINEEDIT_SET_SHARED_HISTORY_OK 0
+#define LINEEDIT_SET_SHARED_HISTORY_FAILED -1
+
 int32_t lineedit_keypress(struct lineedit *le, int c);
 #define LINEEDIT_OK 0
 #define LINEEDIT_FAILED -1
 #define LINEEDIT_ENTER -2
 #define LINEEDIT_TAB -3
 
+/**
+ * @brief Process a buffer of input characters.
+ *
+ * Equivalent to calling lineedit_keypress for every character of @a buf,
+ * but runs of printable characters are inserted at once and the rest of
+ * the line is redrawn only once per run. Processing stops after a character
+ * which finished the editation (LINEEDIT_ENTER) or requested completion
+ * (LINEEDIT_TAB). Remaining characters should be passed in the next call.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param buf Input characters. Cannot be NULL.
+ * @param len Number of characters in @a buf.
+ * @param consumed Number of processed characters is returned here, including
+ *                 the one which caused LINEEDIT_ENTER or LINEEDIT_TAB to be
+ *                 returned. Cannot be NULL.
+ *
+ * @return LINEEDIT_OK if the whole buffer was processed, LINEEDIT_ENTER or
+ *         LINEEDIT_TAB if processing stopped early or LINEEDIT_FAILED
+ *         (parameters invalid).
+ */
+int32_t lineedit_feed(struct lineedit *le, const char *buf, uint32_t len, uint32_t *consumed);
+
+/**
+ * @brief Get the last key decoded from an input escape sequence.
+ *
+ * Keys not used by the editor itself (eg. function keys) can be handled by
+ * the application this way after lineedit_keypress returns.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param key The last decoded key is returned here. Cannot be NULL.
+ * @param mod Modifiers (LINEEDIT_MOD_* flags) are returned here. Cannot be
+ *            NULL.
+ *
+ * @return LINEEDIT_GET_KEY_OK on success or LINEEDIT_GET_KEY_FAILED otherwise.
+ */
+int32_t lineedit_get_key(struct lineedit *le, enum lineedit_key *key, uint32_t *mod);
+#define LINEEDIT_GET_KEY_OK 0
+#define LINEEDIT_GET_KEY_FAILED -1
+
 int32_t lineedit_backspace(struct lineedit *le);
 #define LINEEDIT_BACKSPACE_OK 0
 #define LINEEDIT_BACKSPACE_FAILED -1
 
+/**
+ * @brief Set a buffer for the undo log.
+ *
+ * Edits of the line are logged as inserted or deleted text together with
+ * its position. Consecutive single character edits are merged into a single
+ * undo step, replacing the line (eg. when the history is recalled) and
+ * pasting a text are single steps too. The oldest records are dropped if
+ * the buffer is full. Ctrl+_ undoes the last step, Ctrl+Y redoes it. The log
+ * is reset by lineedit_clear.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param buf Buffer for the log. It must remain valid while the context is
+ *            used. NULL disables undo (the default).
+ * @param size Size of the buffer in bytes.
+ *
+ * @return LINEEDIT_SET_UNDO_BUFFER_OK on success or
+ *         LINEEDIT_SET_UNDO_BUFFER_FAILED otherwise.
+ */
+int32_t lineedit_set_undo_buffer(struct lineedit *le, uint8_t *buf, uint32_t size);
+#define LINEEDIT_SET_UNDO_BUFFER_OK 0
+#define LINEEDIT_SET_UNDO_BUFFER_FAILED -1
+
+/**
+ * @brief Undo the last edit of the line.
+ *
+ * Only the changed part of the line is redrawn.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_UNDO_OK on success or LINEEDIT_UNDO_FAILED if there is
+ *         nothing to undo.
+ */
+int32_t lineedit_undo(struct lineedit *le);
+#define LINEEDIT_UNDO_OK 0
+#define LINEEDIT_UNDO_FAILED -1
+
+/**
+ * @brief Redo the last undone edit of the line.
+ *
+ * Undone edits can be redone until the line is edited again.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_REDO_OK on success or LINEEDIT_REDO_FAILED if there is
+ *         nothing to redo.
+ */
+int32_t lineedit_redo(struct lineedit *le);
+#define LINEEDIT_REDO_OK 0
+#define LINEEDIT_REDO_FAILED -1
+
+/**
+ * @brief Insert a character at the cursor position.
+ *
+ * In the UTF-8 mode, bytes of multibyte characters are collected until the
+ * character is complete, it is then inserted at once.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param c Printable ASCII character or a byte of an UTF-8 encoded one.
+ *
+ * @return LINEEDIT_INSERT_CHAR_OK on success or
+ *         LINEEDIT_INSERT_CHAR_FAILED otherwise (not printable or the line
+ *         is full).
+ */
 int32_t lineedit_insert_char(struct lineedit *le, int c);
 #define LINEEDIT_INSERT_CHAR_OK 0
 #define LINEEDIT_INSERT_CHAR_FAILED -1
 
+/**
+ * @brief Get statistics of the context.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param stats Statistics are copied here. Cannot be NULL.
+ *
+ * @return LINEEDIT_GET_STATS_OK on success or LINEEDIT_GET_STATS_FAILED
+ *         otherwise (including statistics compiled out).
+ */
+int32_t lineedit_get_stats(struct lineedit *le, struct lineedit_stats *stats);
+#define LINEEDIT_GET_STATS_OK 0
+#define LINEEDIT_GET_STATS_FAILED -1
+
+/**
+ * @brief Reset all statistics of the context to zero.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_RESET_STATS_OK on success or LINEEDIT_RESET_STATS_FAILED
+ *         otherwise (including statistics compiled out).
+ */
+int32_t lineedit_reset_stats(struct lineedit *le);
+#define LINEEDIT_RESET_STATS_OK 0
+#define LINEEDIT_RESET_STATS_FAILED -1
+
+/**
+ * @brief Set a timestamp function used to measure keypress latency.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param timestamp Function returning current time in arbitrary ticks (eg.
+ *                  microseconds). NULL disables latency measurement.
+ * @param ctx Argument passed to @a timestamp.
+ *
+ * @return LINEEDIT_SET_TIMESTAMP_OK on success or
+ *         LINEEDIT_SET_TIMESTAMP_FAILED otherwise (including statistics
+ *         compiled out).
+ */
+int32_t lineedit_set_timestamp(struct lineedit *le, uint32_t (*timestamp)(void *ctx), void *ctx);
+#define LINEEDIT_SET_TIMESTAMP_OK 0
+#define LINEEDIT_SET_TIMESTAMP_FAILED -1
+
+/**
+ * @brief Set the function used to print all output.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param print_handler Function printing a zero terminated string. It returns
+ *                      0 if everything was written or the number of unwritten
+ *                      bytes at the end of the string. Such output is
+ *                      retried by @a lineedit_output_resume. Cannot be NULL.
+ * @param ctx Argument passed to @a print_handler.
+ *
+ * @return LINEEDIT_SET_PRINT_HANDLER_OK on success or
+ *         LINEEDIT_SET_PRINT_HANDLER_FAILED otherwise.
+ */
 int32_t lineedit_set_print_handler(struct lineedit *le, int32_t (*print_handler)(const char *line, void *ctx), void *ctx);
 #define LINEEDIT_SET_PRINT_HANDLER_OK 0
 #define LINEEDIT_SET_PRINT_HANDLER_FAILED -1
@@ -204,10 +1187,137 @@ int32_t lineedit_set_prompt_callback(struct lineedit *le, int32_t (*prompt_callb
 #define LINEEDIT_SET_PROMPT_CALLBACK_OK 0
 #define LINEEDIT_SET_PROMPT_CALLBACK_FAILED -1
 
+/**
+ * @brief Render the prompt again on the next refresh.
+ *
+ * The prompt callback output is cached and the prompt callback is not
+ * called again until the prompt is invalidated. Call this function when
+ * the prompt changes (and lineedit_refresh to display it). The width of
+ * the prompt is measured from the rendered output, escape sequences are
+ * not counted.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_INVALIDATE_PROMPT_OK on success or
+ *         LINEEDIT_INVALIDATE_PROMPT_FAILED otherwise.
+ */
+int32_t lineedit_invalidate_prompt(struct lineedit *le);
+#define LINEEDIT_INVALIDATE_PROMPT_OK 0
+#define LINEEDIT_INVALIDATE_PROMPT_FAILED -1
+
+/**
+ * @brief Redraw the whole line including the prompt.
+ *
+ * Use when the terminal contents are unknown, eg. at the beginning of
+ * editation or after the application printed something.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_REFRESH_OK on success or LINEEDIT_REFRESH_FAILED otherwise.
+ */
 int32_t lineedit_refresh(struct lineedit *le);
 #define LINEEDIT_REFRESH_OK 0
 #define LINEEDIT_REFRESH_FAILED -1
 
+/**
+ * @brief Update the terminal to show the current line.
+ *
+ * The line is compared with a copy of the terminal contents. Only the part
+ * after the first difference is printed. If the terminal contents are not
+ * known (the line was not refreshed yet or ENTER was pressed since),
+ * the whole line is refreshed.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_UPDATE_OK on success or LINEEDIT_UPDATE_FAILED otherwise.
+ */
+int32_t lineedit_update(struct lineedit *le);
+#define LINEEDIT_UPDATE_OK 0
+#define LINEEDIT_UPDATE_FAILED -1
+
+/**
+ * @brief Configure bracketed paste.
+ *
+ * In bracketed paste mode (enabled by default) the terminal marks pasted
+ * text. It is inserted without redrawing the line after every character,
+ * the line is updated once when the paste ends.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param enable Enable bracketed paste mode on the next refresh if set,
+ *               disable it immediately otherwise.
+ * @param newline Handling of pasted newlines, one of LINEEDIT_PASTE_NEWLINE_*
+ *                values (LINEEDIT_PASTE_NEWLINE_SPACE by default).
+ *
+ * @return LINEEDIT_SET_PASTE_MODE_OK on success or
+ *         LINEEDIT_SET_PASTE_MODE_FAILED otherwise.
+ */
+int32_t lineedit_set_paste_mode(struct lineedit *le, uint32_t enable, uint32_t newline);
+#define LINEEDIT_SET_PASTE_MODE_OK 0
+#define LINEEDIT_SET_PASTE_MODE_FAILED -1
+
+/**
+ * @brief Enable or disable UTF-8 input and editing.
+ *
+ * UTF-8 is enabled by default. Cursor movement and deletion work on whole
+ * characters including combining marks following them, wide characters take
+ * two terminal columns. If disabled, only ASCII characters can be entered
+ * and 8 bit C1 control characters are recognized instead.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param enable Nonzero to enable UTF-8.
+ *
+ * @return LINEEDIT_SET_UTF8_OK on success or LINEEDIT_SET_UTF8_FAILED
+ *         otherwise.
+ */
+int32_t lineedit_set_utf8(struct lineedit *le, uint32_t enable);
+#define LINEEDIT_SET_UTF8_OK 0
+#define LINEEDIT_SET_UTF8_FAILED -1
+
+/**
+ * @brief Set the terminal width.
+ *
+ * Lines longer than the terminal width are scrolled horizontally. Only the
+ * visible part around the cursor is rendered and the cost of a redraw does
+ * not depend on the line length. The '<' and '>' markers are shown where
+ * the line continues outside the terminal. Completion candidates are
+ * arranged in columns to fit the width. Call lineedit_refresh after the
+ * terminal is resized.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param width Terminal width in columns, 0 (default) if it is unknown and
+ *              the line should be displayed as a whole.
+ *
+ * @return LINEEDIT_SET_WIDTH_OK on success or LINEEDIT_SET_WIDTH_FAILED
+ *         otherwise.
+ */
+int32_t lineedit_set_width(struct lineedit *le, uint32_t width);
+#define LINEEDIT_SET_WIDTH_OK 0
+#define LINEEDIT_SET_WIDTH_FAILED -1
+
+/**
+ * @brief Enable or disable the multi-line mode.
+ *
+ * In the multi-line mode, the line may contain newlines. Ctrl+J inserts
+ * a newline, ENTER finishes the line as usual. Every newline starts a new
+ * terminal row beginning with the continuation prompt. Up and down keys move
+ * the cursor between rows, history is recalled only from the first or the
+ * last row. An edit redraws rows from the edited one onward, rows above it
+ * are kept. The horizontal scrolling is not used, rows are expected to fit
+ * the terminal width.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param enable Nonzero to enable the multi-line mode.
+ * @param cont_prompt Continuation prompt printed as is, without escape
+ *                    sequences. The string must stay valid while the mode
+ *                    is enabled. NULL is the same as an empty string.
+ *
+ * @return LINEEDIT_SET_MULTILINE_OK on success or
+ *         LINEEDIT_SET_MULTILINE_FAILED otherwise.
+ */
+int32_t lineedit_set_multiline(struct lineedit *le, uint32_t enable, const char *cont_prompt);
+#define LINEEDIT_SET_MULTILINE_OK 0
+#define LINEEDIT_SET_MULTILINE_FAILED -1
+
 int32_t lineedit_get_cursor(struct lineedit *le, uint32_t *cursor);
 #define LINEEDIT_GET_CURSOR_OK 0
 #define LINEEDIT_GET_CURSOR_FAILED -1
@@ -216,6 +1326,18 @@ int32_t lineedit_set_cursor(struct lineedit *le, uint32_t cursor);
 #define LINEEDIT_SET_CURSOR_OK 0
 #define LINEEDIT_SET_CURSOR_FAILED -1
 
+/**
+ * @brief Get the edited line.
+ *
+ * The line is made contiguous and zero terminated. The returned pointer
+ * is valid until the line is modified.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param text Pointer to the line is returned here. Cannot be NULL.
+ *
+ * @return LINEEDIT_GET_LINE_OK on success or LINEEDIT_GET_LINE_FAILED
+ *         otherwise.
+ */
 int32_t lineedit_get_line(struct lineedit *le, char **text);
 #define LINEEDIT_GET_LINE_OK 0
 #define LINEEDIT_GET_LINE_FAILED -1
@@ -232,6 +1354,62 @@ int32_t lineedit_insert(struct lineedit *le, const char *text);
 #define LINEEDIT_INSERT_OK 0
 #define LINEEDIT_INSERT_FAILED -1
 
+/**
+ * @brief Build a command completion trie.
+ *
+ * Words of the vocabulary may contain spaces to describe commands with
+ * sub-commands (eg. "show ip route"), words are then separated by a single
+ * space. The trie is built in caller supplied arrays, no memory is
+ * allocated. The order of @a words does not matter.
+ *
+ * @param t Trie to build. Cannot be NULL.
+ * @param nodes Array for trie nodes. Cannot be NULL.
+ * @param max_nodes Size of @a nodes, LINEEDIT_TRIE_NODES(count) is enough.
+ * @param labels Label pool. Cannot be NULL.
+ * @param labels_size Size of @a labels, sum of all word lengths is enough.
+ * @param words Vocabulary. Cannot be NULL.
+ * @param count Number of @a words.
+ *
+ * @return LINEEDIT_TRIE_BUILD_OK on success or LINEEDIT_TRIE_BUILD_FAILED
+ *         otherwise (including @a nodes or @a labels too small).
+ */
+int32_t lineedit_trie_build(struct lineedit_trie *t, struct lineedit_trie_node *nodes, uint32_t max_nodes, char *labels, uint32_t labels_size, const char * const *words, uint32_t count);
+#define LINEEDIT_TRIE_BUILD_OK 0
+#define LINEEDIT_TRIE_BUILD_FAILED -1
 
+/**
+ * @brief Set the vocabulary used for command completion.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ * @param trie Trie built by lineedit_trie_build. It must remain valid while
+ *             the context is used. NULL disables the completion, TAB is
+ *             then reported to the application (LINEEDIT_TAB).
+ *
+ * @return LINEEDIT_SET_COMPLETION_OK on success or
+ *         LINEEDIT_SET_COMPLETION_FAILED otherwise.
+ */
+int32_t lineedit_set_completion(struct lineedit *le, const struct lineedit_trie *trie);
+#define LINEEDIT_SET_COMPLETION_OK 0
+#define LINEEDIT_SET_COMPLETION_FAILED -1
 
+/**
+ * @brief Complete the command before the cursor.
+ *
+ * Called when TAB is pressed if the completion vocabulary is set. The line
+ * up to the cursor is looked up in the vocabulary. The longest common
+ * extension of all matching commands is inserted at once (followed by
+ * a space if the command is complete). If there is nothing to insert and
+ * more commands match, the candidates for the word under the cursor are
+ * listed in columns and the line is printed again.
+ *
+ * @param le Lineedit context. Cannot be NULL.
+ *
+ * @return LINEEDIT_COMPLETE_OK if something was inserted or listed,
+ *         LINEEDIT_COMPLETE_NONE if nothing matches or
+ *         LINEEDIT_COMPLETE_FAILED otherwise.
+ */
+int32_t lineedit_complete(struct lineedit *le);
+#define LINEEDIT_COMPLETE_OK 0
+#define LINEEDIT_COMPLETE_FAILED -1
+#define LINEEDIT_COMPLETE_NONE 1
 
@@ -0,0 +1,448 @@
+/**
+ * Copyright (c) 2014, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "lineedit.h"
+#include "lineedit_history_file.h"
+
+
+#define LINEEDIT_HISTORY_FILE_MAGIC 0x5348454c
+#define LINEEDIT_HISTORY_FILE_LOG_MAGIC 0x4c48454c
+#define LINEEDIT_HISTORY_FILE_VERSION 1
+#define LINEEDIT_HISTORY_FILE_MAX_RECORD 0x8000
+
+/* Snapshot file starts with this header followed by the arena. Fields are
+ * stored in the host byte order, a file written on a platform with another
+ * byte order has a wrong magic number and is replaced. The arena is not
+ * checked when mapped, lineedit never follows record lengths out of it. */
+struct lineedit_history_file_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t generation;
+	uint32_t size;
+	uint32_t tail;
+	uint32_t head;
+	uint32_t wrap;
+	uint32_t count;
+	uint32_t history_count;
+	uint32_t crc;
+};
+
+/* Log file starts with a magic number and the generation of the snapshot it
+ * belongs to. Every record is the length and CRC-32 of its payload followed
+ * by the payload (the saved line including the terminator). */
+struct lineedit_history_file_log_header {
+	uint32_t magic;
+	uint32_t generation;
+};
+
+struct lineedit_history_file_record {
+	uint32_t len;
+	uint32_t crc;
+};
+
+
+/* CRC-32 (IEEE 802.3) computed by nibbles to keep the table small. */
+static uint32_t lineedit_history_file_crc(const void *data, uint32_t len) {
+	static const uint32_t table[16] = {
+		0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+		0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+		0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+		0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+	};
+	const uint8_t *p = data;
+	uint32_t crc = 0xffffffff;
+
+	for (uint32_t i = 0; i < len; i++) {
+		crc = (crc >> 4) ^ table[(crc ^ p[i]) & 0x0f];
+		crc = (crc >> 4) ^ table[(crc ^ (p[i] >> 4)) & 0x0f];
+	}
+
+	return crc ^ 0xffffffff;
+}
+
+
+static int32_t lineedit_history_file_write(int fd, const void *data, uint32_t len) {
+	const uint8_t *p = data;
+
+	while (len > 0) {
+		ssize_t ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+
+/* Write a snapshot of the arena @a r to a temporary file and rename it over
+ * the snapshot. An empty arena of @a r->size bytes is written if @a r has no
+ * buffer. */
+static int32_t lineedit_history_file_snapshot(struct lineedit_history_file *hf, const struct lineedit_ring *r, uint32_t history_count, uint32_t generation) {
+	char tmp[sizeof(hf->log_path)];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", hf->path);
+
+	struct lineedit_history_file_header h = {
+		.magic = LINEEDIT_HISTORY_FILE_MAGIC,
+		.version = LINEEDIT_HISTORY_FILE_VERSION,
+		.generation = generation,
+		.size = r->size,
+		.tail = r->tail,
+		.head = r->head,
+		.wrap = r->wrap,
+		.count = r->count,
+		.history_count = history_count,
+	};
+	h.crc = lineedit_history_file_crc(&h, offsetof(struct lineedit_history_file_header, crc));
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		return -1;
+	}
+
+	int32_t ret = lineedit_history_file_write(fd, &h, sizeof(h));
+	if (ret == 0) {
+		if (r->buf != NULL) {
+			ret = lineedit_history_file_write(fd, r->buf, r->size);
+		} else {
+			ret = ftruncate(fd, (off_t)sizeof(h) + r->size);
+		}
+	}
+	if (ret == 0) {
+		ret = fsync(fd);
+	}
+	if (close(fd) < 0) {
+		ret = -1;
+	}
+	if (ret == 0) {
+		ret = rename(tmp, hf->path);
+	}
+	if (ret != 0) {
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Map the snapshot and attach its arena to the editor. Returns -2 if the
+ * snapshot does not exist or it is not a valid snapshot, -1 on other
+ * errors. */
+static int32_t lineedit_history_file_map(struct lineedit_history_file *hf) {
+	int fd = open(hf->path, O_RDONLY);
+	if (fd < 0) {
+		return (errno == ENOENT) ? -2 : -1;
+	}
+
+	struct lineedit_history_file_header h;
+	struct stat st;
+	ssize_t ret;
+	if (fstat(fd, &st) < 0 ||
+	    (ret = pread(fd, &h, sizeof(h), 0)) < 0) {
+		close(fd);
+		return -1;
+	}
+	if (ret != sizeof(h) ||
+	    h.magic != LINEEDIT_HISTORY_FILE_MAGIC ||
+	    h.version != LINEEDIT_HISTORY_FILE_VERSION ||
+	    h.crc != lineedit_history_file_crc(&h, offsetof(struct lineedit_history_file_header, crc)) ||
+	    h.size > (UINT32_MAX - sizeof(h)) ||
+	    (uint64_t)st.st_size != (sizeof(h) + h.size)) {
+		close(fd);
+		return -2;
+	}
+
+	/* Pages are loaded on demand. The mapping is private, the editor
+	 * modifies the arena in memory only. */
+	uint32_t map_size = sizeof(h) + h.size;
+	uint8_t *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return -1;
+	}
+
+	struct lineedit_ring r = {
+		.buf = map + sizeof(h),
+		.size = h.size,
+		.tail = h.tail,
+		.head = h.head,
+		.wrap = h.wrap,
+		.count = h.count,
+	};
+	if (lineedit_history_attach(hf->le, &r, h.history_count) != LINEEDIT_HISTORY_ATTACH_OK) {
+		munmap(map, map_size);
+		return -2;
+	}
+
+	hf->map = map;
+	hf->map_size = map_size;
+	hf->generation = h.generation;
+
+	return 0;
+}
+
+
+/* Empty the log and start it for the current snapshot generation. */
+static int32_t lineedit_history_file_log_reset(struct lineedit_history_file *hf) {
+	struct lineedit_history_file_log_header h = {
+		.magic = LINEEDIT_HISTORY_FILE_LOG_MAGIC,
+		.generation = hf->generation,
+	};
+
+	if (ftruncate(hf->log_fd, 0) < 0 ||
+	    lineedit_history_file_write(hf->log_fd, &h, sizeof(h)) < 0) {
+		return -1;
+	}
+	hf->log_size = sizeof(h);
+
+	return 0;
+}
+
+
+/* Open the log and replay its records on top of the snapshot. The log is
+ * truncated after the last valid record, a log belonging to another
+ * snapshot is emptied. */
+static int32_t lineedit_history_file_replay(struct lineedit_history_file *hf) {
+	hf->log_fd = open(hf->log_path, O_RDWR | O_CREAT | O_APPEND, 0600);
+	if (hf->log_fd < 0) {
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(hf->log_fd, &st) < 0) {
+		return -1;
+	}
+
+	struct lineedit_history_file_log_header h;
+	uint32_t valid = 0;
+	uint8_t *log = NULL;
+	if (st.st_size >= (off_t)sizeof(h) && st.st_size <= UINT32_MAX) {
+		log = malloc(st.st_size);
+		if (log == NULL) {
+			return -1;
+		}
+		if (pread(hf->log_fd, log, st.st_size, 0) != st.st_size) {
+			free(log);
+			return -1;
+		}
+		memcpy(&h, log, sizeof(h));
+		if (h.magic == LINEEDIT_HISTORY_FILE_LOG_MAGIC && h.generation == hf->generation) {
+			valid = sizeof(h);
+		}
+	}
+
+	/* Stop at the first record which is incomplete or damaged. */
+	while (valid > 0 && (uint64_t)(st.st_size - valid) >= sizeof(struct lineedit_history_file_record)) {
+		struct lineedit_history_file_record rec;
+		memcpy(&rec, log + valid, sizeof(rec));
+		const uint8_t *payload = log + valid + sizeof(rec);
+
+		if (rec.len == 0 ||
+		    rec.len > LINEEDIT_HISTORY_FILE_MAX_RECORD ||
+		    rec.len > (st.st_size - valid - sizeof(rec)) ||
+		    payload[rec.len - 1] != '\0' ||
+		    rec.crc != lineedit_history_file_crc(payload, rec.len)) {
+			break;
+		}
+		lineedit_history_append(hf->le, (const char *)payload);
+		valid += sizeof(rec) + rec.len;
+	}
+	free(log);
+
+	if (valid == 0) {
+		return lineedit_history_file_log_reset(hf);
+	}
+	if (valid < st.st_size && ftruncate(hf->log_fd, valid) < 0) {
+		return -1;
+	}
+	hf->log_size = valid;
+
+	return 0;
+}
+
+
+/* History callback appending saved lines to the log. */
+static void lineedit_history_file_append(struct lineedit *le, const char *line, void *ctx) {
+	struct lineedit_history_file *hf = (struct lineedit_history_file *)ctx;
+	(void)le;
+
+	uint32_t len = strlen(line) + 1;
+	struct lineedit_history_file_record rec = {
+		.len = len,
+		.crc = lineedit_history_file_crc(line, len),
+	};
+	struct iovec iov[2] = {
+		{.iov_base = &rec, .iov_len = sizeof(rec)},
+		{.iov_base = (void *)line, .iov_len = len},
+	};
+
+	/* The whole record is written at once. If it fails, a part of the
+	 * record may be left in the log, compaction starts a new one. */
+	ssize_t ret = writev(hf->log_fd, iov, 2);
+	if (ret != (ssize_t)(sizeof(rec) + len)) {
+		lineedit_history_file_compact(hf);
+		return;
+	}
+
+	hf->log_size += ret;
+	if (hf->log_size > hf->log_limit) {
+		lineedit_history_file_compact(hf);
+	}
+}
+
+
+/* Rename an invalid snapshot and its log, appending ".bad" to their
+ * names. Nothing is done if the snapshot does not exist. */
+static int32_t lineedit_history_file_set_aside(struct lineedit_history_file *hf) {
+	char bad[sizeof(hf->log_path) + 4];
+
+	snprintf(bad, sizeof(bad), "%s.bad", hf->path);
+	if (rename(hf->path, bad) < 0) {
+		return (errno == ENOENT) ? 0 : -1;
+	}
+	snprintf(bad, sizeof(bad), "%s.bad", hf->log_path);
+	if (rename(hf->log_path, bad) < 0 && errno != ENOENT) {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int32_t lineedit_history_file_open(struct lineedit_history_file *hf, struct lineedit *le, const char *path, uint32_t size) {
+	if (u_assert(hf != NULL) ||
+	    u_assert(le != NULL) ||
+	    u_assert(le->text != NULL) ||
+	    u_assert(path != NULL)) {
+		return LINEEDIT_HISTORY_FILE_OPEN_FAILED;
+	}
+
+	memset(hf, 0, sizeof(struct lineedit_history_file));
+	hf->le = le;
+	hf->log_fd = -1;
+	hf->saved = le->history;
+	hf->saved_count = le->history_count;
+
+	if (strlen(path) >= sizeof(hf->path)) {
+		return LINEEDIT_HISTORY_FILE_OPEN_FAILED;
+	}
+	strcpy(hf->path, path);
+	snprintf(hf->log_path, sizeof(hf->log_path), "%s.log", path);
+
+	/* Create a new snapshot if there is none. An invalid one is kept
+	 * aside together with its log, the history is not thrown away. */
+	int32_t ret = lineedit_history_file_map(hf);
+	if (ret == -1) {
+		return LINEEDIT_HISTORY_FILE_OPEN_FAILED;
+	}
+	if (ret == -2) {
+		if (lineedit_history_file_set_aside(hf) < 0) {
+			return LINEEDIT_HISTORY_FILE_OPEN_FAILED;
+		}
+		struct lineedit_ring empty = {
+			.size = size,
+		};
+		if (size > (UINT32_MAX - sizeof(struct lineedit_history_file_header)) ||
+		    lineedit_history_file_snapshot(hf, &empty, 0, 1) < 0 ||
+		    lineedit_history_file_map(hf) < 0) {
+			return LINEEDIT_HISTORY_FILE_OPEN_FAILED;
+		}
+	}
+
+	/* Replayed lines are already in the log. */
+	lineedit_set_history_callback(le, NULL, NULL);
+	if (lineedit_history_file_replay(hf) < 0) {
+		lineedit_history_file_close(hf);
+		return LINEEDIT_HISTORY_FILE_OPEN_FAILED;
+	}
+
+	/* The log never needs to be longer than the arena, older records are
+	 * evicted anyway. */
+	hf->log_limit = hf->map_size;
+	lineedit_set_history_callback(le, lineedit_history_file_append, hf);
+
+	return LINEEDIT_HISTORY_FILE_OPEN_OK;
+}
+
+
+int32_t lineedit_history_file_compact(struct lineedit_history_file *hf) {
+	if (u_assert(hf != NULL) ||
+	    u_assert(hf->le != NULL) ||
+	    u_assert(hf->log_fd >= 0)) {
+		return LINEEDIT_HISTORY_FILE_COMPACT_FAILED;
+	}
+
+	/* The old log is ignored as soon as the new snapshot is in place. */
+	if (lineedit_history_file_snapshot(hf, &hf->le->history, hf->le->history_count, hf->generation + 1) < 0) {
+		return LINEEDIT_HISTORY_FILE_COMPACT_FAILED;
+	}
+	hf->generation++;
+
+	if (lineedit_history_file_log_reset(hf) < 0) {
+		return LINEEDIT_HISTORY_FILE_COMPACT_FAILED;
+	}
+
+	return LINEEDIT_HISTORY_FILE_COMPACT_OK;
+}
+
+
+int32_t lineedit_history_file_close(struct lineedit_history_file *hf) {
+	if (u_assert(hf != NULL) ||
+	    u_assert(hf->le != NULL)) {
+		return LINEEDIT_HISTORY_FILE_CLOSE_FAILED;
+	}
+
+	lineedit_set_history_callback(hf->le, NULL, NULL);
+	lineedit_history_attach(hf->le, &hf->saved, hf->saved_count);
+
+	if (hf->log_fd >= 0) {
+		close(hf->log_fd);
+		hf->log_fd = -1;
+	}
+	if (hf->map != NULL) {
+		munmap(hf->map, hf->map_size);
+		hf->map = NULL;
+	}
+
+	return LINEEDIT_HISTORY_FILE_CLOSE_OK;
+}
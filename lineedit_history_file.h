@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) 2014, Marek Koza (qyx@krtko.org)
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this
+ *    list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ * ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#pragma once
+
+/**
+ * Optional persistent history for POSIX systems. The history arena is kept
+ * in a snapshot file which is mapped to memory when opened, no records are
+ * parsed. Lines saved to the history after the snapshot was taken are
+ * appended to a log file (the snapshot path with ".log" appended) and
+ * replayed on top of the snapshot when opened. Compaction writes a new
+ * snapshot and empties the log.
+ *
+ * Snapshot is replaced atomically (written to a temporary file and renamed).
+ * Log records are length prefixed and checksummed, a partially written
+ * record left by a crash is discarded. The log belongs to the snapshot with
+ * the same generation number, a log left behind by a compaction interrupted
+ * after the new snapshot was written is ignored.
+ */
+
+#include <stdint.h>
+
+#include "lineedit.h"
+
+#ifndef LINEEDIT_HISTORY_FILE_PATH_LEN
+#define LINEEDIT_HISTORY_FILE_PATH_LEN 256
+#endif
+
+
+struct lineedit_history_file {
+	struct lineedit *le;
+
+	/**
+	 * History arena used by the editor before the file was opened, it is
+	 * restored when the file is closed.
+	 */
+	struct lineedit_ring saved;
+	uint32_t saved_count;
+
+	/**
+	 * Private mapping of the snapshot file. Changes done by the editor are
+	 * not written back, they are saved in the log.
+	 */
+	uint8_t *map;
+	uint32_t map_size;
+	uint32_t generation;
+
+	/**
+	 * Log file descriptor and its size. Log is compacted automatically
+	 * when it grows over @a log_limit bytes.
+	 */
+	int log_fd;
+	uint32_t log_size;
+	uint32_t log_limit;
+
+	char path[LINEEDIT_HISTORY_FILE_PATH_LEN];
+	char log_path[LINEEDIT_HISTORY_FILE_PATH_LEN + 4];
+};
+
+
+/**
+ * @brief Open a history file and use it as the history of a line editor.
+ *
+ * The snapshot is mapped and the log replayed. If the snapshot does not
+ * exist, a new empty one is created. A snapshot which is not valid is
+ * renamed together with its log (".bad" is appended to their names) and
+ * replaced by an empty one. Every line saved to the history of @a le is
+ * appended to the log from now on.
+ *
+ * @param hf History file context. Cannot be NULL.
+ * @param le Initialized lineedit context. Cannot be NULL.
+ * @param path Path to the snapshot file. Cannot be NULL.
+ * @param size Size of the history arena in bytes used when a new snapshot is
+ *             created, an existing snapshot keeps its size. It must be able
+ *             to hold at least one full line.
+ *
+ * @return LINEEDIT_HISTORY_FILE_OPEN_OK on success or
+ *         LINEEDIT_HISTORY_FILE_OPEN_FAILED otherwise (the files cannot be
+ *         read, created or mapped). The files are left unchanged then.
+ */
+int32_t lineedit_history_file_open(struct lineedit_history_file *hf, struct lineedit *le, const char *path, uint32_t size);
+#define LINEEDIT_HISTORY_FILE_OPEN_OK 0
+#define LINEEDIT_HISTORY_FILE_OPEN_FAILED -1
+
+/**
+ * @brief Write the current history to a new snapshot and empty the log.
+ *
+ * It is done automatically when the log grows over the size of the arena,
+ * call it periodically or before exiting to keep the log short.
+ *
+ * @param hf History file context. Cannot be NULL.
+ *
+ * @return LINEEDIT_HISTORY_FILE_COMPACT_OK on success or
+ *         LINEEDIT_HISTORY_FILE_COMPACT_FAILED otherwise (the files were
+ *         left unchanged or the log was not emptied).
+ */
+int32_t lineedit_history_file_compact(struct lineedit_history_file *hf);
+#define LINEEDIT_HISTORY_FILE_COMPACT_OK 0
+#define LINEEDIT_HISTORY_FILE_COMPACT_FAILED -1
+
+/**
+ * @brief Close the history file.
+ *
+ * The editor continues with the history it had before the file was opened.
+ *
+ * @param hf History file context. Cannot be NULL.
+ *
+ * @return LINEEDIT_HISTORY_FILE_CLOSE_OK on success or
+ *         LINEEDIT_HISTORY_FILE_CLOSE_FAILED otherwise.
+ */
+int32_t lineedit_history_file_close(struct lineedit_history_file *hf);
+#define LINEEDIT_HISTORY_FILE_CLOSE_OK 0
+#define LINEEDIT_HISTORY_FILE_CLOSE_FAILED -1